@@ -0,0 +1,165 @@
+#include "../include/mist_log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <process.h>
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Measures how many messages per second 1 to 64 threads can log to two in-memory targets, once with the
+// built-in per-target locks and once with a single user lock on the logger, which serializes every write.
+
+#define MESSAGES_PER_THREAD 200000
+#define MAX_THREADS 64
+
+struct MemoryTarget {
+    char buffer[4096];
+    size_t used;
+};
+
+static void memory_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ctx) {
+    struct MemoryTarget* memory = ctx;
+    size_t size = string_size(msg);
+    if(memory->used + size > sizeof(memory->buffer))
+        memory->used = 0;
+
+    memcpy(memory->buffer + memory->used, string_data(msg), size);
+    memory->used += size;
+}
+
+static LogTarget* memory_target_create(struct MemoryTarget* memory) {
+    char layout[] = "${level} | ${message}";
+    struct LogFormat* format = mist_log_parse_format(layout, 0, strlen(layout));
+    LogTarget* target = malloc(sizeof(*target));
+    if(!format || !target) {
+        free(target);
+        return NULL;
+    }
+
+    log_target_init(target, format, LOG_TRACE, LOG_FATAL);
+    target->log = memory_log;
+    target->ctx = memory;
+    return target;
+}
+
+#ifdef _WIN32
+
+typedef HANDLE BenchThread;
+static CRITICAL_SECTION logger_mutex;
+
+static void logger_lock(void* mutex, bool lock) {
+    if(lock)
+        EnterCriticalSection(mutex);
+    else
+        LeaveCriticalSection(mutex);
+}
+
+static double now_seconds(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+typedef pthread_t BenchThread;
+static pthread_mutex_t logger_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void logger_lock(void* mutex, bool lock) {
+    if(lock)
+        pthread_mutex_lock(mutex);
+    else
+        pthread_mutex_unlock(mutex);
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#endif
+
+#ifdef _WIN32
+static unsigned __stdcall log_messages(void* ctx) {
+#else
+static void* log_messages(void* ctx) {
+#endif
+    Logger* logger = ctx;
+    for(int i = 0; i < MESSAGES_PER_THREAD; i++)
+        log_info(logger, "Message %d from a worker thread", i);
+
+    return 0;
+}
+
+static double run(Logger* logger, int thread_count) {
+    BenchThread threads[MAX_THREADS];
+    double start = now_seconds();
+
+    for(int i = 0; i < thread_count; i++) {
+#ifdef _WIN32
+        threads[i] = (HANDLE)_beginthreadex(NULL, 0, log_messages, logger, 0, NULL);
+#else
+        pthread_create(threads + i, NULL, log_messages, logger);
+#endif
+    }
+
+    for(int i = 0; i < thread_count; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+
+    double elapsed = now_seconds() - start;
+    return (double)thread_count * MESSAGES_PER_THREAD / elapsed;
+}
+
+int main(void) {
+    static struct MemoryTarget memory[2];
+
+    Logger* logger = log_logger_create();
+    if(!logger)
+        return EXIT_FAILURE;
+
+    for(int i = 0; i < 2; i++) {
+        LogTarget* target = memory_target_create(memory + i);
+        if(!target || !log_add_target(logger, target)) {
+            log_target_free(target);
+            log_logger_free(logger);
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifdef _WIN32
+    InitializeCriticalSection(&logger_mutex);
+#endif
+
+    printf("threads | target locks (msg/s) | logger lock (msg/s)\n");
+    for(int thread_count = 1; thread_count <= MAX_THREADS; thread_count *= 2) {
+        log_set_lock(logger, NULL, NULL);
+        double target_locks = run(logger, thread_count);
+
+        log_set_lock(logger, &logger_mutex, logger_lock);
+        double single_lock = run(logger, thread_count);
+
+        printf("%7d | %20.0f | %19.0f\n", thread_count, target_locks, single_lock);
+    }
+
+    log_set_lock(logger, NULL, NULL);
+    log_logger_free(logger);
+
+#ifdef _WIN32
+    DeleteCriticalSection(&logger_mutex);
+#endif
+
+    return EXIT_SUCCESS;
+}
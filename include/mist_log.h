@@ -52,6 +52,83 @@ enum FileArchiveTiming {
     FILE_ARCHIVE_SATURDAY
 };
 
+enum LogQueueFullPolicy {
+    LOG_QUEUE_BLOCK,
+    LOG_QUEUE_DROP,
+    LOG_QUEUE_DROP_BELOW_LEVEL
+};
+
+/**
+ * Describes a single log statement. The log macros define one of these for each call site,
+ * so its address can be used to identify the site.
+ */
+struct LogSite {
+    enum LogLevel level;
+    uint32_t line;
+    const char* file;
+    const char* function;
+
+    /**
+     * Switches checked inline by the log macros. A site is logged if force is set, or if keep is set and
+     * the logger accepts its level. Sites start out forced so that their first call registers them with
+     * the library, which then sets both from the rules given to mist_log_sites_set.
+     */
+    volatile unsigned char keep;
+    volatile unsigned char force;
+
+    /**
+     * Set by the library once the site has been added to its registry.
+     */
+    volatile unsigned char registered;
+
+    /**
+     * The next site in the registry.
+     */
+    struct LogSite* next;
+};
+
+/**
+ * Describes a single log call. Built once per call and shared by every layout renderer and target it reaches.
+ */
+typedef struct LogEvent {
+    enum LogLevel level;
+    const char* file;
+    const char* function;
+    uint32_t line;
+
+    /**
+     * The call site that logged the event, or NULL if it wasn't logged through a call site descriptor.
+     */
+    const struct LogSite* site;
+
+    /**
+     * The time the event was logged, in nanoseconds since the Unix epoch.
+     */
+    uint64_t timestamp;
+
+    /**
+     * The id of the thread that logged the event.
+     */
+    uint64_t thread_id;
+
+    /**
+     * A process wide number that increases with each logged event.
+     */
+    uint64_t sequence;
+
+    /**
+     * The user's message with its arguments applied. Only rendered if a layout uses it, otherwise NULL.
+     */
+    const String* message;
+
+    /**
+     * The user's format string and arguments, or NULL if the event only has the rendered message
+     * (e.g. when it is written by the writer thread of an asynchronous logger). Copy args with va_copy before reading it.
+     */
+    const char* format;
+    va_list* args;
+} LogEvent;
+
 /**
  * Renders a layout to a log message.
  */
@@ -70,6 +147,12 @@ struct LogLayoutRenderer {
      * A method used to destroy the context value if needed.
      */ 
     void (*free)(void* ctx);
+
+    /**
+     * A method used to append a string determined by the LogLayoutRenderer to the output message from a LogEvent.
+     * Only used when append is NULL.
+     */
+    bool (*append_event)(const LogEvent* event, String* output, void* ctx);
 };
 
 /**
@@ -87,6 +170,28 @@ struct LogFormat {
      * The number of steps used to build a log message.
      */
     int step_count;
+
+    /**
+     * The steps compiled into a flat list of instructions, or NULL to run the steps directly.
+     * Built-in layout renderers are run inline, and only custom renderers are called through their append method.
+     */
+    void* program;
+
+    /**
+     * The size of the compiled program in bytes.
+     */
+    size_t program_size;
+
+    /**
+     * Whether rendering the format may read the message of a LogEvent.
+     */
+    bool uses_message;
+
+    /**
+     * Whether rendering the format changes state owned by its target (e.g. the binary writer), in which case it is
+     * rendered while holding the target's lock instead of before taking it.
+     */
+    bool stateful;
 };
 
 /**
@@ -122,14 +227,56 @@ typedef struct LogTarget {
      * The maximum log level allowed to log a message to this target.
      */
     enum LogLevel max_level;
+
+    /**
+     * The method used by this target to log a message rendered from a LogEvent. Only used when log is NULL.
+     */
+    void (*log_event)(const LogEvent* event, String* msg, void* ctx);
+
+    /**
+     * A method that writes out anything the target has buffered. Optional.
+     */
+    void (*flush)(void* ctx);
+
+    /**
+     * A mutex that is held while a message is written to this target instead of the built-in lock. Optional.
+     */
+    void* mutex;
+
+    /**
+     * A user-defined method to lock/unlock the mutex.
+     */
+    void (*lock)(void* mtx, bool lock);
+
+    /**
+     * The state of the built-in lock that is held while a message is written to this target,
+     * unless a user lock is set on the target or its logger. 0 while unlocked.
+     */
+    volatile uint32_t lock_state;
+
+    /**
+     * Whether the target is only ever written to by one thread at a time, in which case the built-in lock isn't used.
+     * False by default, so that a zero-initialized target is thread-safe.
+     */
+    bool single_threaded;
+
+    /**
+     * Set by log_target_init to mark the members after max_level as initialized. Targets added to a logger without
+     * it have those members reset to zero by log_add_target.
+     */
+    uint32_t initialized;
 } LogTarget;
 
+struct LogSnapshot;
+
 /**
  * Used to log formatted messages to various log targets.
+ * 
+ * Loggers form a tree of named children (e.g. "net.http") that inherit the targets and level of their parents.
  */
 typedef struct Logger {
     /**
-     * An array of targets that log messages are sent to.
+     * An array of the targets that were added to this logger. Owned by the logger.
      */
     struct LogTarget** targets;
 
@@ -152,6 +299,69 @@ typedef struct Logger {
      * The maximum number of items allowed in the targets array before it has to resize.
      */
     int target_capacity;
+
+    /**
+     * The queue and writer thread used to send messages to the targets when the logger is asynchronous. NULL if the logger is synchronous.
+     */
+    struct LogAsyncQueue* async;
+
+    /**
+     * A bit mask of the levels accepted by at least one target (bit n is set for level n).
+     * Checked by the log macros before calling into the library.
+     */
+    volatile unsigned int level_mask;
+
+    /**
+     * The name of the logger relative to its parent. NULL for a logger created with log_logger_create.
+     */
+    char* name;
+
+    /**
+     * The logger this logger is a child of. NULL for a logger created with log_logger_create.
+     */
+    struct Logger* parent;
+
+    /**
+     * The logger at the top of the tree. Its lock and asynchronous queue are used by all of its children.
+     */
+    struct Logger* root;
+
+    /**
+     * The first child of the logger. The rest are linked through next_sibling.
+     */
+    struct Logger* first_child;
+
+    /**
+     * The next child of the same parent.
+     */
+    struct Logger* next_sibling;
+
+    /**
+     * The minimum level set with log_logger_set_level. Only used when has_level is true.
+     */
+    enum LogLevel level;
+
+    /**
+     * Determines if the logger has its own minimum level instead of inheriting the level of its parent.
+     */
+    bool has_level;
+
+    /**
+     * The minimum level that is actually used, either the logger's own or the nearest parent's.
+     */
+    enum LogLevel effective_level;
+
+    /**
+     * An immutable copy of the targets of the logger and its parents and the levels they accept.
+     * Replaced as a whole whenever the configuration changes, so log calls can read it without locking.
+     */
+    struct LogSnapshot* volatile snapshot;
+
+    /**
+     * The targets and levels applied by the last call to log_logger_load_config, which replaces them on the next call.
+     * NULL if no configuration was loaded.
+     */
+    struct LogConfigApplied* config;
 } Logger;
 
 struct LogFileTargetContext;
@@ -162,25 +372,132 @@ struct LogFileTargetContext;
 LOG_EXPORT Logger* log_logger_create();
 
 /**
- * Frees all the resources used by a logger, than frees the logger.
+ * Frees all the resources used by a logger and its children, than frees the logger.
+ * 
+ * @remarks Can be called from a target while it's writing a message for another logger. The logger being freed must
+ *          not be in use by any other call at the same time.
  */
 LOG_EXPORT void log_logger_free(Logger* logger);
 
+/**
+ * Stops the background thread the library starts for timers and archiving, once it has finished its queued work.
+ * Call it after every logger has been freed and before the library is unloaded (e.g. with dlclose), from a thread
+ * that isn't logging. The thread is started again if it's needed afterwards.
+ */
+LOG_EXPORT void log_shutdown(void);
+
+/**
+ * Gets the child of a logger with the specified name, creating it if it doesn't exist yet.
+ * 
+ * @param name A dot separated path relative to the logger (e.g. "net.http"). Missing loggers along the path are created as well.
+ * @remarks The child is freed along with its parent. Its targets and level are inherited from its parents.
+ */
+LOG_EXPORT Logger* log_logger_get_child(Logger* logger, const char* name);
+
+/**
+ * Sets the minimum level of messages that a logger and the children that don't have their own level will log.
+ */
+LOG_EXPORT void log_logger_set_level(Logger* logger, enum LogLevel level);
+
+/**
+ * Removes the level set with log_logger_set_level so that the logger uses the level of its parent again.
+ */
+LOG_EXPORT void log_logger_inherit_level(Logger* logger);
+
+/**
+ * Initializes a user-defined log target with the given format and levels and everything else turned off,
+ * after which its callbacks and context can be set.
+ * 
+ * @remarks Targets that aren't initialized with this only have to set the members up to max_level. log_add_target
+ *          resets the rest to zero, so any of them that are set on such a target (e.g. a lock) are ignored.
+ */
+LOG_EXPORT void log_target_init(LogTarget* target, struct LogFormat* format, enum LogLevel min_level, enum LogLevel max_level);
+
+/**
+ * Writes out any messages a log target has buffered (e.g. the buffers of a file target).
+ */
+LOG_EXPORT void log_target_flush(LogTarget* target);
+
 /**
  * Frees the resources used by a log target, than frees the log target.
  */
 LOG_EXPORT void log_target_free(LogTarget* target);
 
 /**
- * Adds a log target to a logger.
+ * Adds a log target to a logger. The children of the logger log to it as well.
+ * 
+ * @remarks Loggers can be configured while other threads are logging to them.
+ *          A target can be added to several loggers of the same tree. It's written to once per message,
+ *          and freed along with the last of those loggers.
  */
 LOG_EXPORT bool log_add_target(Logger* logger, LogTarget* target);
 
 /**
- * Sets the lock method and mutex value used by a logger. If either is NULL, the logger will never lock and will not be thread-safe.
+ * Removes a log target from the logger it was added to, and frees it once no log call can be using it anymore.
+ */
+LOG_EXPORT bool log_remove_target(Logger* logger, LogTarget* target);
+
+/**
+ * Recomputes the levels a logger and its children accept. Must be called after changing the min_level or max_level
+ * of a target that has already been added, on the logger the target was added to (or any of its parents).
+ */
+LOG_EXPORT void log_logger_refresh_levels(Logger* logger);
+
+/**
+ * Sets the lock method and mutex value used by a logger. If either is NULL, the built-in locks of the targets are used.
+ * The children of a logger use the lock of the logger at the top of their tree, so setting it on a child sets it for that logger.
+ * 
+ * @remarks Targets are thread-safe without a user lock, and each has its own lock so that a slow target doesn't block the others.
+ *          A logger lock replaces those with a single lock that is held while a message is written to any target that
+ *          doesn't have a user lock of its own. Messages are formatted before taking it, except for layouts with custom
+ *          layout renderers, which are formatted while holding the lock of the target they're written to. A custom renderer
+ *          is therefore never run concurrently if it's only used by one target or if the logger has a lock.
  */
 LOG_EXPORT void log_set_lock(Logger* logger, void* mutex, void (*lock)(void* mtx, bool lock));
 
+/**
+ * Sets the lock method and mutex value held while a message is written to a target, instead of the logger's lock.
+ * Targets with separate locks can be written to by different threads at the same time.
+ */
+LOG_EXPORT void log_target_set_lock(LogTarget* target, void* mutex, void (*lock)(void* mtx, bool lock));
+
+/**
+ * Makes a logger asynchronous. Messages are still formatted on the calling thread, but are then pushed onto a
+ * queue that a background thread drains into the log targets.
+ * 
+ * @param capacity The maximum number of messages that can wait in the queue. Rounded up to the next power of two.
+ * @param policy Determines what happens to a message that is logged while the queue is full.
+ * @param drop_below_level When the policy is LOG_QUEUE_DROP_BELOW_LEVEL, messages below this level are dropped while the queue is full.
+ *                         Messages at or above it wait for space in the queue.
+ * @remarks Only loggers created with log_logger_create can be made asynchronous. Their children share the queue.
+ */
+LOG_EXPORT bool log_logger_enable_async(Logger* logger, size_t capacity, enum LogQueueFullPolicy policy, enum LogLevel drop_below_level);
+
+/**
+ * Moves all message formatting of an asynchronous logger onto its writer thread. The calling thread only copies the
+ * format string and its arguments (strings are copied, everything else is stored as is) into the queue.
+ * 
+ * @remarks Fails if the logger isn't asynchronous. Applies to every logger that shares the queue, i.e. the whole tree.
+ *          Messages whose format uses conversions that can't be captured (e.g. %n or wide strings) are formatted on
+ *          the calling thread instead.
+ */
+LOG_EXPORT bool log_logger_set_deferred_formatting(Logger* logger, bool deferred);
+
+/**
+ * Blocks until every message logged so far has been written out. Waits for the queue of an asynchronous logger to be
+ * sent to its targets, then flushes every target the logger writes to, including those inherited from its parents.
+ * 
+ * @remarks File targets buffer messages below their flush level by default, and log_logger_free writes them out.
+ *          A program that exits without freeing its loggers (e.g. by calling exit()) should call this first.
+ */
+LOG_EXPORT void log_logger_flush(Logger* logger);
+
+/**
+ * Gets the number of messages an asynchronous logger has dropped because its queue was full. Children count the
+ * messages dropped by the whole tree, since they share the queue of their root.
+ */
+LOG_EXPORT size_t log_logger_dropped_count(Logger* logger);
+
 /**
  * Creates a log target that outputs to the console.
  * 
@@ -196,24 +513,149 @@ LOG_EXPORT void log_file_target_context_free(struct LogFileTargetContext* ctx);
 
 LOG_EXPORT bool log_file_target_context_archive_fname(struct LogFileTargetContext* ctx, char* archive_fname);
 
+/**
+ * Sets how many bytes of messages each file of a file target collects before writing them at once (64 KiB by default).
+ * 
+ * @param size The size of each file's buffer. 0 uses the default size.
+ * @param mode _IOFBF to buffer messages, _IOLBF or _IONBF to write every message as soon as it's logged.
+ * 
+ * @remarks File targets are buffered by default: messages below the flush level (LOG_ERROR) are held for up to
+ *          the flush interval (1000 ms) or until the buffer is full. Buffered messages are written when the target is
+ *          freed or flushed with log_logger_flush, log_target_flush or log_file_target_context_flush, but are lost
+ *          if the process ends without any of those. Use _IONBF to write every message as soon as it's logged.
+ *          Targets that close their files after every message write each one immediately regardless.
+ */
 LOG_EXPORT bool log_file_target_context_set_buffering(struct LogFileTargetContext* ctx, size_t size, int mode);
 
+/**
+ * Writes the buffered messages of every open file of a file target.
+ */
+LOG_EXPORT void log_file_target_context_flush(struct LogFileTargetContext* ctx);
+
+/**
+ * Sets the longest time a message waits in a file's buffer (1000 ms by default).
+ * 
+ * @remarks Buffers that reach this age are written by a housekeeping thread even if nothing else is logged.
+ *          Without thread support, the age of a buffer is only checked when a message is written to its file.
+ */
+LOG_EXPORT void log_file_target_context_set_flush_interval(struct LogFileTargetContext* ctx, uint32_t max_age_ms);
+
+/**
+ * Sets the level at and above which a message is written immediately, along with everything buffered before it (LOG_ERROR by default).
+ */
+LOG_EXPORT void log_file_target_context_set_flush_level(struct LogFileTargetContext* ctx, enum LogLevel level);
+
+/**
+ * Sets how many archives of each file are kept before the oldest ones are deleted.
+ * 
+ * @remarks Archives are remembered in a manifest next to the log file (with the ".li" extension), which keeps
+ *          track of at most 128 archives with names shorter than 256 characters. Archives that aren't numbered
+ *          are never deleted. Archives listed by the text files older versions kept there are carried over.
+ */
 LOG_EXPORT void log_file_target_context_set_max_archive_files(struct LogFileTargetContext* ctx, int max_file_count);
 
+/**
+ * Sets how many days archives are kept before they're deleted. Takes precedence over the maximum number of archives.
+ * 
+ * @remarks The same limits apply as for log_file_target_context_set_max_archive_files.
+ */
 LOG_EXPORT void log_file_target_context_set_max_archive_days(struct LogFileTargetContext* ctx, int max_file_days);
 
 LOG_EXPORT void log_file_target_context_archive_on_size(struct LogFileTargetContext* ctx, size_t max_size);
 
+/**
+ * Archives the files of a file target periodically. Files are archived by a housekeeping thread as soon as their
+ * period ends, whether or not anything is logged to them, unless nothing was written since they were last archived.
+ */
 LOG_EXPORT void log_file_target_archive_on_date(struct LogFileTargetContext* ctx, enum FileArchiveTiming timing);
 
 LOG_EXPORT void log_file_target_context_archive_number_sequence(struct LogFileTargetContext* ctx);
 
 LOG_EXPORT bool log_file_target_context_archive_number_date(struct LogFileTargetContext* ctx, char* date_string);
 
+/**
+ * Keeps every file written by a file target open until the target is freed, instead of at most 32 at once.
+ */
 LOG_EXPORT bool log_file_target_context_keep_files_open(struct LogFileTargetContext* ctx);
 
+/**
+ * Sets how many files a file target keeps open at once (32 by default). When another file needs to be opened,
+ * the one that was written least recently is closed.
+ * 
+ * @param count The number of files to keep open. 0 closes each file after every message.
+ */
+LOG_EXPORT void log_file_target_context_set_max_open_files(struct LogFileTargetContext* ctx, size_t count);
+
+/**
+ * Closes files that haven't been written to for the given time. Files are closed by a housekeeping thread,
+ * and are opened again by the next message written to them.
+ * 
+ * @param timeout_ms How long a file may be idle, in milliseconds. 0 (the default) keeps idle files open.
+ */
+LOG_EXPORT void log_file_target_context_set_idle_timeout(struct LogFileTargetContext* ctx, uint32_t timeout_ms);
+
 LOG_EXPORT LogTarget* log_target_file_create(const char* layout, enum LogLevel min_level, enum LogLevel max_level, struct LogFileTargetContext* ctx);
 
+/**
+ * Creates a log target that writes messages to a compact binary file instead of formatting them.
+ * 
+ * The format string, file, function and line of each call site are written once, after which every message
+ * only stores the site, its timestamp and its raw arguments. Use mist_log_binary_replay or the
+ * mist_log_decode tool to turn the file back into text.
+ * 
+ * @param fname The name of the file to append to.
+ * @param min_level The minimum level of log messages to allow to this target.
+ * @param max_level The maximum level of log messages to allow to this target.
+ */
+LOG_EXPORT LogTarget* log_target_binary_create(const char* fname, enum LogLevel min_level, enum LogLevel max_level);
+
+/**
+ * Reads a file created by a binary log target and logs every message in it to a logger,
+ * which formats them using the layouts of its own targets. Messages keep the time they were originally logged at.
+ */
+LOG_EXPORT bool mist_log_binary_replay(const char* fname, Logger* logger);
+
+struct LogConfigWatcher;
+
+/**
+ * Applies a configuration file to a logger and its children, adding the targets and setting the levels it describes.
+ * 
+ * The file is made of sections with "key = value" lines:
+ * 
+ *     [logger net.http]       Sets the level of a child ("[logger]" for the logger itself) to a level name or "inherit".
+ *     level = trace
+ * 
+ *     [target]                Adds a target to the logger named by "logger" (the logger itself by default).
+ *     logger = net.http
+ *     type = file             console, file or binary.
+ *     layout = ${level} | ${message}
+ *     min_level = debug
+ *     max_level = fatal
+ *     file = app.log          File and binary targets only.
+ *     archive_size = 1048576  File targets only, as are max_archive_files, keep_files_open, max_open_files,
+ *                             idle_timeout (in ms), buffer_size, flush_interval (in ms) and flush_level.
+ * 
+ * @remarks Nothing is changed if the file can't be read or contains an error. Loading another file (or the same one
+ *          again) into the same logger replaces the targets added by the previous one and lets the levels it set be
+ *          inherited again. Targets added by the file must not be removed by hand.
+ */
+LOG_EXPORT bool log_logger_load_config(Logger* logger, const char* fname);
+
+/**
+ * Applies a configuration file to a logger like log_logger_load_config, then applies it again every time the file changes.
+ * Each time, the targets added by the previous version of the file are replaced and the levels it set are inherited again,
+ * without blocking the threads that are logging in the meantime.
+ * 
+ * @remarks Only supported on Linux, returns NULL elsewhere. Targets added by the file must not be removed by hand,
+ *          and the logger must outlive the watcher.
+ */
+LOG_EXPORT struct LogConfigWatcher* log_logger_watch_config(Logger* logger, const char* fname);
+
+/**
+ * Stops watching a configuration file. The targets and levels it applied are left in place.
+ */
+LOG_EXPORT void log_config_watcher_free(struct LogConfigWatcher* watcher);
+
 /**
  * Registers a custom LogLayoutRenderer.
  * 
@@ -256,6 +698,11 @@ LOG_EXPORT bool mist_log_format_read_arg_value(char* text, size_t* start, size_t
  */
 LOG_EXPORT bool mist_log_format(struct LogFormat* log_format, enum LogLevel level, const char* file, const char* function, uint32_t line, String* message, char* format_string, va_list args);
 
+/**
+ * Given a LogFormat, appends the log message rendered from a LogEvent to output.
+ */
+LOG_EXPORT bool mist_log_format_event(struct LogFormat* log_format, const LogEvent* event, String* output);
+
 /**
  * Logs a string value using the specified logger. Does not support logging the calling function name.
  */
@@ -276,8 +723,166 @@ LOG_EXPORT bool mist_log_cstr(Logger* logger, enum LogLevel log_level, const cha
  */
 LOG_EXPORT bool mist_log_func_cstr(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const char* message, ...);
 
+/**
+ * Logs a c-string from a call site described by site. Used by the log macros where the compiler supports it.
+ */
+LOG_EXPORT bool mist_log_site(Logger* logger, struct LogSite* site, const char* message, ...);
+
+/**
+ * Logs a string value from a call site described by site.
+ */
+LOG_EXPORT bool mist_log_site_string(Logger* logger, struct LogSite* site, const String* message, ...);
+
+/**
+ * Overrides the level of every call site whose file path, file name or function matches a glob pattern
+ * ('*' and '?' wildcards). Matching sites at or above level are logged even if no target's min_level accepts
+ * them, and matching sites below level are turned off. Later calls take precedence over earlier ones, and the
+ * rules also apply to sites that haven't run yet.
+ * 
+ * @remarks Only sites logged through the call site descriptors emitted by the log macros are affected.
+ */
+LOG_EXPORT bool mist_log_sites_set(const char* pattern, enum LogLevel level);
+
+/**
+ * Removes every rule added by mist_log_sites_set, returning all call sites to the levels of their loggers.
+ */
+LOG_EXPORT void mist_log_sites_clear(void);
+
+
+/**
+ * Determines if any target of a logger accepts a log level. The log macros use this to skip disabled
+ * messages without calling into the library, so the logger passed to them must not be NULL.
+ * 
+ * @remarks Without GNU statement expressions, the log macros evaluate their logger argument twice (once for this
+ *          check and once for the call), so it shouldn't have side effects. With them it's evaluated once.
+ */
+#define mist_log_level_enabled(logger, level) (((logger)->level_mask >> (level)) & 1u)
+
+/**
+ * Determines if a call site should be logged, without a branch for the site's switches.
+ */
+#define mist_log_site_enabled(logger, site) ((((logger)->level_mask >> (site).level) & (site).keep) | (site).force)
+
+// Numeric versions of the LogLevel values that can be used by the preprocessor.
+#define MIST_LOG_LEVEL_TRACE 0
+#define MIST_LOG_LEVEL_DEBUG 1
+#define MIST_LOG_LEVEL_INFO 2
+#define MIST_LOG_LEVEL_WARN 3
+#define MIST_LOG_LEVEL_ERROR 4
+#define MIST_LOG_LEVEL_FATAL 5
+
+/**
+ * The lowest level that the log macros are compiled for. Define it as one of the MIST_LOG_LEVEL_* values
+ * before including this header (or with the compile_min_level meson option).
+ * 
+ * Macros below this level expand to an unevaluated sizeof of the log call, so their arguments are still
+ * type-checked but no code or string literals are emitted for them. Like enabled macros, they have the value
+ * true, as if the message had been filtered out at run time.
+ */
+#ifndef MIST_LOG_COMPILE_MIN_LEVEL
+#define MIST_LOG_COMPILE_MIN_LEVEL MIST_LOG_LEVEL_TRACE
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+// A statement expression, so that elided calls used as statements don't warn about an unused value.
+#define mist_log_elided(call) __extension__ ({ (void)sizeof(call); true; })
+#else
+#define mist_log_elided(call) ((void)sizeof(call), true)
+#endif
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_TRACE
+#define mist_log_compiled_trace(call) (call)
+#else
+#define mist_log_compiled_trace(call) mist_log_elided(call)
+#endif
+#define mist_log_if_trace(logger, call) mist_log_compiled_trace(mist_log_level_enabled(logger, LOG_TRACE) ? (call) : true)
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_DEBUG
+#define mist_log_compiled_debug(call) (call)
+#else
+#define mist_log_compiled_debug(call) mist_log_elided(call)
+#endif
+#define mist_log_if_debug(logger, call) mist_log_compiled_debug(mist_log_level_enabled(logger, LOG_DEBUG) ? (call) : true)
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_INFO
+#define mist_log_compiled_info(call) (call)
+#else
+#define mist_log_compiled_info(call) mist_log_elided(call)
+#endif
+#define mist_log_if_info(logger, call) mist_log_compiled_info(mist_log_level_enabled(logger, LOG_INFO) ? (call) : true)
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_WARN
+#define mist_log_compiled_warn(call) (call)
+#else
+#define mist_log_compiled_warn(call) mist_log_elided(call)
+#endif
+#define mist_log_if_warn(logger, call) mist_log_compiled_warn(mist_log_level_enabled(logger, LOG_WARN) ? (call) : true)
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_ERROR
+#define mist_log_compiled_error(call) (call)
+#else
+#define mist_log_compiled_error(call) mist_log_elided(call)
+#endif
+#define mist_log_if_error(logger, call) mist_log_compiled_error(mist_log_level_enabled(logger, LOG_ERROR) ? (call) : true)
+
+#if MIST_LOG_COMPILE_MIN_LEVEL <= MIST_LOG_LEVEL_FATAL
+#define mist_log_compiled_fatal(call) (call)
+#else
+#define mist_log_compiled_fatal(call) mist_log_elided(call)
+#endif
+#define mist_log_if_fatal(logger, call) mist_log_compiled_fatal(mist_log_level_enabled(logger, LOG_FATAL) ? (call) : true)
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L && (defined(__GNUC__) || defined(__clang__))
+
+// Each macro expansion defines a static descriptor of its call site, so only the logger, the site
+// and the message are passed at every call. Requires statement expressions, which also let the logger
+// expression be evaluated only once.
+#define mist_log_at_site(logger, level, function, message, ...) \
+    __extension__ ({ \
+        Logger* mist_log_logger_ = (logger); \
+        static struct LogSite mist_log_site_ = { (level), __LINE__, __FILE__, __func__, 1, 1, 0, 0 }; \
+        mist_log_site_enabled(mist_log_logger_, mist_log_site_) ? function(mist_log_logger_, &mist_log_site_, message, ## __VA_ARGS__) : true; \
+    })
+
+#if __STDC_VERSION__ >= 201112L
+
+#define mist_log_generic(logger, level, message, ...) \
+    mist_log_at_site(logger, level, \
+        _Generic(message, \
+            char*: mist_log_site, \
+            const char*: mist_log_site, \
+            String*: mist_log_site_string, \
+            const String*: mist_log_site_string), \
+        message, ## __VA_ARGS__)
+
+#else // __STDC_VERSION__ >= 201112L
+
+#define mist_log_generic(logger, level, message, ...) mist_log_at_site(logger, level, mist_log_site, message, ## __VA_ARGS__)
+
+#endif
 
-#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define log_trace(logger, message, ...) mist_log_compiled_trace(mist_log_generic(logger, LOG_TRACE, message, ## __VA_ARGS__))
+#define log_debug(logger, message, ...) mist_log_compiled_debug(mist_log_generic(logger, LOG_DEBUG, message, ## __VA_ARGS__))
+#define log_info(logger, message, ...) mist_log_compiled_info(mist_log_generic(logger, LOG_INFO, message, ## __VA_ARGS__))
+#define log_warn(logger, message, ...) mist_log_compiled_warn(mist_log_generic(logger, LOG_WARN, message, ## __VA_ARGS__))
+#define log_error(logger, message, ...) mist_log_compiled_error(mist_log_generic(logger, LOG_ERROR, message, ## __VA_ARGS__))
+#define log_fatal(logger, message, ...) mist_log_compiled_fatal(mist_log_generic(logger, LOG_FATAL, message, ## __VA_ARGS__))
+
+#define log_cstr_trace(logger, message, ...) mist_log_compiled_trace(mist_log_at_site(logger, LOG_TRACE, mist_log_site, message, ## __VA_ARGS__))
+#define log_cstr_debug(logger, message, ...) mist_log_compiled_debug(mist_log_at_site(logger, LOG_DEBUG, mist_log_site, message, ## __VA_ARGS__))
+#define log_cstr_info(logger, message, ...) mist_log_compiled_info(mist_log_at_site(logger, LOG_INFO, mist_log_site, message, ## __VA_ARGS__))
+#define log_cstr_warn(logger, message, ...) mist_log_compiled_warn(mist_log_at_site(logger, LOG_WARN, mist_log_site, message, ## __VA_ARGS__))
+#define log_cstr_error(logger, message, ...) mist_log_compiled_error(mist_log_at_site(logger, LOG_ERROR, mist_log_site, message, ## __VA_ARGS__))
+#define log_cstr_fatal(logger, message, ...) mist_log_compiled_fatal(mist_log_at_site(logger, LOG_FATAL, mist_log_site, message, ## __VA_ARGS__))
+
+#define log_string_trace(logger, message, ...) mist_log_compiled_trace(mist_log_at_site(logger, LOG_TRACE, mist_log_site_string, message, ## __VA_ARGS__))
+#define log_string_debug(logger, message, ...) mist_log_compiled_debug(mist_log_at_site(logger, LOG_DEBUG, mist_log_site_string, message, ## __VA_ARGS__))
+#define log_string_info(logger, message, ...) mist_log_compiled_info(mist_log_at_site(logger, LOG_INFO, mist_log_site_string, message, ## __VA_ARGS__))
+#define log_string_warn(logger, message, ...) mist_log_compiled_warn(mist_log_at_site(logger, LOG_WARN, mist_log_site_string, message, ## __VA_ARGS__))
+#define log_string_error(logger, message, ...) mist_log_compiled_error(mist_log_at_site(logger, LOG_ERROR, mist_log_site_string, message, ## __VA_ARGS__))
+#define log_string_fatal(logger, message, ...) mist_log_compiled_fatal(mist_log_at_site(logger, LOG_FATAL, mist_log_site_string, message, ## __VA_ARGS__))
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
 
 #if __STDC_VERSION__ >= 201112L
 
@@ -291,61 +896,61 @@ LOG_EXPORT bool mist_log_func_cstr(Logger* logger, enum LogLevel log_level, cons
         String*: mist_log_func_string, \
         const String*: mist_log_func_string)((logger), (level), __FILE__, __func__, __LINE__, message, ## __VA_ARGS__)
 
-#define log_trace(logger, message, ...) mist_log_generic(logger, LOG_TRACE, message, __VA_ARGS__)
-#define log_debug(logger, message, ...) mist_log_generic(logger, LOG_DEBUG, message, __VA_ARGS__)
-#define log_info(logger, message, ...) mist_log_generic(logger, LOG_INFO, message, __VA_ARGS__)
-#define log_warn(logger, message, ...) mist_log_generic(logger, LOG_WARN, message, __VA_ARGS__)
-#define log_error(logger, message, ...) mist_log_generic(logger, LOG_ERROR, message, __VA_ARGS__)
-#define log_fatal(logger, message, ...) mist_log_generic(logger, LOG_FATAL, message, __VA_ARGS__)
+#define log_trace(logger, message, ...) mist_log_if_trace(logger, mist_log_generic(logger, LOG_TRACE, message, ## __VA_ARGS__))
+#define log_debug(logger, message, ...) mist_log_if_debug(logger, mist_log_generic(logger, LOG_DEBUG, message, ## __VA_ARGS__))
+#define log_info(logger, message, ...) mist_log_if_info(logger, mist_log_generic(logger, LOG_INFO, message, ## __VA_ARGS__))
+#define log_warn(logger, message, ...) mist_log_if_warn(logger, mist_log_generic(logger, LOG_WARN, message, ## __VA_ARGS__))
+#define log_error(logger, message, ...) mist_log_if_error(logger, mist_log_generic(logger, LOG_ERROR, message, ## __VA_ARGS__))
+#define log_fatal(logger, message, ...) mist_log_if_fatal(logger, mist_log_generic(logger, LOG_FATAL, message, ## __VA_ARGS__))
     
 
 #else // __STDC_VERSION__ >= 201112L
 
-#define log_trace(logger, ...) mist_log_func_cstr((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_debug(logger, ...) mist_log_func_cstr((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_info(logger, ...) mist_log_func_cstr((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_warn(logger, ...) mist_log_func_cstr((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_error(logger, ...) mist_log_func_cstr((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_fatal(logger, ...) mist_log_func_cstr((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define log_trace(logger, ...) mist_log_if_trace(logger, mist_log_func_cstr((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_debug(logger, ...) mist_log_if_debug(logger, mist_log_func_cstr((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_info(logger, ...) mist_log_if_info(logger, mist_log_func_cstr((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_warn(logger, ...) mist_log_if_warn(logger, mist_log_func_cstr((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_error(logger, ...) mist_log_if_error(logger, mist_log_func_cstr((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_func_cstr((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__))
 
 #endif
 
-#define log_cstr_trace(logger, ...) mist_log_func_cstr((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_cstr_debug(logger, ...) mist_log_func_cstr((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_cstr_info(logger, ...) mist_log_func_cstr((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_cstr_warn(logger, ...) mist_log_func_cstr((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_cstr_error(logger, ...) mist_log_func_cstr((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_cstr_fatal(logger, ...) mist_log_func_cstr((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define log_cstr_trace(logger, ...) mist_log_if_trace(logger, mist_log_func_cstr((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_cstr_debug(logger, ...) mist_log_if_debug(logger, mist_log_func_cstr((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_cstr_info(logger, ...) mist_log_if_info(logger, mist_log_func_cstr((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_cstr_warn(logger, ...) mist_log_if_warn(logger, mist_log_func_cstr((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_cstr_error(logger, ...) mist_log_if_error(logger, mist_log_func_cstr((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_cstr_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_func_cstr((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__))
 
-#define log_string_trace(logger, ...) mist_log_func_string((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_string_debug(logger, ...) mist_log_func_string((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_string_info(logger, ...) mist_log_func_string((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_string_warn(logger, ...) mist_log_func_string((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_string_error(logger, ...) mist_log_func_string((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define log_string_fatal(logger, ...) mist_log_func_string((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define log_string_trace(logger, ...) mist_log_if_trace(logger, mist_log_func_string((logger), LOG_TRACE, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_string_debug(logger, ...) mist_log_if_debug(logger, mist_log_func_string((logger), LOG_DEBUG, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_string_info(logger, ...) mist_log_if_info(logger, mist_log_func_string((logger), LOG_INFO, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_string_warn(logger, ...) mist_log_if_warn(logger, mist_log_func_string((logger), LOG_WARN, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_string_error(logger, ...) mist_log_if_error(logger, mist_log_func_string((logger), LOG_ERROR, __FILE__, __func__, __LINE__, __VA_ARGS__))
+#define log_string_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_func_string((logger), LOG_FATAL, __FILE__, __func__, __LINE__, __VA_ARGS__))
 
 #else // __STDC_VERSION__ >= 199901L
 
-#define log_trace(logger, ...) mist_log_cstr((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(logger, ...) mist_log_cstr((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(logger, ...) mist_log_cstr((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(logger, ...) mist_log_cstr((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(logger, ...) mist_log_cstr((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(logger, ...) mist_log_cstr((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
-
-#define log_cstr_trace(logger, ...) mist_log_cstr((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_cstr_debug(logger, ...) mist_log_cstr((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_cstr_info(logger, ...) mist_log_cstr((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define log_cstr_warn(logger, ...) mist_log_cstr((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define log_cstr_error(logger, ...) mist_log_cstr((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_cstr_fatal(logger, ...) mist_log_cstr((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
-
-#define log_string_trace(logger, ...) mist_log_string((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_string_debug(logger, ...) mist_log_string((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_string_info(logger, ...) mist_log_string((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define log_string_warn(logger, ...) mist_log_string((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define log_string_error(logger, ...) mist_log_string((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_string_fatal(logger, ...) mist_log_string((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+#define log_trace(logger, ...) mist_log_if_trace(logger, mist_log_cstr((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__))
+#define log_debug(logger, ...) mist_log_if_debug(logger, mist_log_cstr((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__))
+#define log_info(logger, ...) mist_log_if_info(logger, mist_log_cstr((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__))
+#define log_warn(logger, ...) mist_log_if_warn(logger, mist_log_cstr((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__))
+#define log_error(logger, ...) mist_log_if_error(logger, mist_log_cstr((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__))
+#define log_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_cstr((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__))
+
+#define log_cstr_trace(logger, ...) mist_log_if_trace(logger, mist_log_cstr((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__))
+#define log_cstr_debug(logger, ...) mist_log_if_debug(logger, mist_log_cstr((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__))
+#define log_cstr_info(logger, ...) mist_log_if_info(logger, mist_log_cstr((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__))
+#define log_cstr_warn(logger, ...) mist_log_if_warn(logger, mist_log_cstr((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__))
+#define log_cstr_error(logger, ...) mist_log_if_error(logger, mist_log_cstr((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__))
+#define log_cstr_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_cstr((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__))
+
+#define log_string_trace(logger, ...) mist_log_if_trace(logger, mist_log_string((logger), LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__))
+#define log_string_debug(logger, ...) mist_log_if_debug(logger, mist_log_string((logger), LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__))
+#define log_string_info(logger, ...) mist_log_if_info(logger, mist_log_string((logger), LOG_INFO, __FILE__, __LINE__, __VA_ARGS__))
+#define log_string_warn(logger, ...) mist_log_if_warn(logger, mist_log_string((logger), LOG_WARN, __FILE__, __LINE__, __VA_ARGS__))
+#define log_string_error(logger, ...) mist_log_if_error(logger, mist_log_string((logger), LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__))
+#define log_string_fatal(logger, ...) mist_log_if_fatal(logger, mist_log_string((logger), LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__))
 
 #endif
 
@@ -2,12 +2,18 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 
 #ifdef _MSC_VER
 
 #define LOG_WINDOWS
 #include <Windows.h>
 #include <sys/stat.h>
+#include <io.h>
+#include <fcntl.h>
 
 #elif defined(__clang__) || defined(__GNUC__)
 
@@ -15,7 +21,17 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <glob.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <linux/futex.h>
+#endif
 
 #if __GNUC__ > 2 || (__GNUC__ == 2 && (__GNUC_MINOR__ >= 28))
 
@@ -25,9 +41,75 @@
 
 #endif
 
+#if defined(LOG_WINDOWS) || defined(LOG_GCC)
+
+#define LOG_THREADS
+
+#endif
+
+#if defined(LOG_WINDOWS)
+
+#define LOG_THREAD_LOCAL __declspec(thread)
+
+#elif defined(LOG_GCC)
+
+#define LOG_THREAD_LOCAL __thread
+
+#else
+
+// Without threads there's only ever one set of thread buffers anyway.
+#define LOG_THREAD_LOCAL
+
+#endif
+
+// Used to keep values written by different threads on separate cache lines.
+#define LOG_CACHE_LINE_SIZE 64
+
+// The number of times a contended target lock is polled before the thread goes to sleep.
+#define LOG_LOCK_SPIN_COUNT 100
+
+// The default size of the buffer each open log file collects messages in before writing them.
+#define LOG_FILE_BUFFER_SIZE 65536
+
+// The default longest time, in milliseconds, that a message waits in a log file's buffer.
+#define LOG_FILE_FLUSH_INTERVAL 1000
+
+// The default number of files a file target keeps open at once.
+#define LOG_FILE_MAX_OPEN_FILES 32
+
+// The longest rendered time that the ${time} renderer caches. Longer times are rendered on every call.
+#define LOG_TIME_CACHE_SIZE 64
+
 struct LogFormatTime {
     String format;
     bool is_utc;
+
+    // Seqlock protecting the text rendered for cached_second. Odd while a thread is rewriting the cache.
+    volatile size_t sequence;
+    volatile time_t cached_second;
+    volatile size_t cached_length;
+    char cached_text[LOG_TIME_CACHE_SIZE];
+};
+
+// The length of the "YYYY-MM-DDTHH:" prefix cached by the ${timestamp} renderer.
+#define LOG_TIMESTAMP_PREFIX_SIZE 14
+
+// The longest time zone suffix rendered by ${timestamp} ("+HH:MM").
+#define LOG_TIMESTAMP_ZONE_SIZE 6
+
+struct LogFormatTimestamp {
+    // The number of fractional second digits (0, 3, 6 or 9).
+    int precision;
+    bool is_utc;
+
+    // Seqlock protecting the cached hour. Odd while a thread is rewriting the cache.
+    volatile size_t sequence;
+
+    // The first UTC second of the local hour described by prefix and zone.
+    volatile int64_t hour_start;
+    volatile size_t zone_length;
+    char prefix[LOG_TIMESTAMP_PREFIX_SIZE];
+    char zone[LOG_TIMESTAMP_ZONE_SIZE];
 };
 
 struct LogLayoutRendererCreator {
@@ -43,27 +125,160 @@ struct LogLayoutRendererFinder {
     size_t capacity;
 };
 
+// Log files are written through the platform's own file descriptors so that messages can be batched in
+// a userspace buffer and written with as few calls as possible.
+#if defined(LOG_WINDOWS) || defined(LOG_GCC)
+
+typedef int LogFd;
+#define LOG_FD_INVALID -1
+
+#else
+
+typedef FILE* LogFd;
+#define LOG_FD_INVALID NULL
+
+#endif
+
+struct LogTimer;
+
+// Called on the housekeeping thread once a timer expires, while holding the lock of the timing wheel, with the
+// wall clock time. The timer isn't scheduled anymore, but can be scheduled again from the callback.
+typedef void (*LogTimerCallback)(struct LogTimer* timer, uint64_t now);
+
+struct LogTimer {
+    struct LogTimer* prev;
+    struct LogTimer* next;
+
+    // The list the timer is in, or NULL if it isn't scheduled.
+    struct LogTimer** list;
+
+    // The tick the timer expires at, counted on the monotonic clock.
+    uint64_t expires;
+
+    // The wall clock time the timer was scheduled for, in nanoseconds since the epoch.
+    uint64_t deadline;
+
+    LogTimerCallback fire;
+    void* ctx;
+};
+
+/**
+ * Work queued for the housekeeping thread.
+ */
+struct LogJob {
+    struct LogJob* next;
+
+    // Runs the job and frees it if it was allocated.
+    void (*run)(struct LogJob* job);
+};
+
+static bool log_timer_schedule(struct LogTimer* timer, uint64_t when);
+static void log_job_post(struct LogJob* job);
+
 struct LogFile {
     struct tm creation_time;
     String name;
-    FILE* file;
+    LogFd fd;
+
+    // Messages that haven't been written to the file yet.
     char* buffer;
+    size_t buffer_used;
+    size_t buffer_capacity;
+
+    // The timestamp of the oldest message in the buffer.
+    uint64_t buffer_time;
+
+    // When the file is archived next, in seconds since the epoch. INT64_MAX if it isn't archived on time.
+    int64_t rollover_time;
+
+    // The size of the file including its buffered messages. Read from the file when it's opened and
+    // counted from then on.
+    uint64_t size;
+
+    // The timestamp of the last message written to the file.
+    uint64_t last_write;
+
+    // When the activity timer fires next, or 0 if it isn't scheduled. The timer flushes the buffer
+    // once it's old enough and closes the file once it has been idle for long enough.
+    uint64_t wake_time;
+
+    struct LogTimer rollover_timer;
+    struct LogTimer activity_timer;
+
     int sequence;
+
+    // The hash of the name, used to find the file in its target's table.
+    size_t hash;
+
+    // Neighbours in the target's list of open files, most recently used first.
+    struct LogFile* lru_prev;
+    struct LogFile* lru_next;
+};
+
+// What the name of a log file depends on, decided when the file name layout is parsed.
+enum LogFileNameKind {
+    // The name is the same for every message.
+    LOG_FILE_NAME_CONSTANT,
+    // The name only depends on the level of a message.
+    LOG_FILE_NAME_LEVEL,
+    // The name depends on the level and the time of a message, down to file_name_unit.
+    LOG_FILE_NAME_TIME,
+    // The name is rendered for every message.
+    LOG_FILE_NAME_DYNAMIC
+};
+
+// The length of the time buckets of a time based file name, from shortest to longest.
+enum LogFileNameUnit {
+    LOG_FILE_NAME_SECOND,
+    LOG_FILE_NAME_MINUTE,
+    LOG_FILE_NAME_HOUR,
+    LOG_FILE_NAME_DAY
 };
 
 struct LogFileTargetContext {
     struct LogFormat* file_name;
     struct LogFormat* archive_file_name;
 
-    struct LogFile* files;
-    int files_count;
-    int files_capacity;
+    enum LogFileNameKind file_name_kind;
+    enum LogFileNameUnit file_name_unit;
+    bool file_name_utc;
+
+    // The files the name resolved to for each level. Constant names only use the first entry, and
+    // time based names only while messages are logged between file_name_start and file_name_end.
+    struct LogFile* resolved_files[LOG_FATAL + 1];
+    time_t file_name_start;
+    time_t file_name_end;
+
+    // Every file written by the target, in an open addressing table keyed by name.
+    struct LogFile** files;
+    size_t files_count;
+    size_t files_capacity;
+
+    // The open files, most recently used first. The least recently used one is closed to make room.
+    struct LogFile* lru_first;
+    struct LogFile* lru_last;
+    size_t open_count;
+
+    // The most files kept open at once. 0 closes each file after every message.
+    size_t max_open_files;
+
+    // How long a file stays open without being written to, in nanoseconds. 0 keeps it open.
+    uint64_t idle_timeout;
+
+    // Guards the files against the housekeeping thread, which archives, flushes and closes them on its own.
+    volatile uint32_t lock_state;
 
     String archive_date_format;
 
-    char* buffer;
+    // The size of the buffer each file collects messages in. 0 writes every message immediately.
     size_t buffer_size;
 
+    // The longest a message waits in a buffer before the buffer is written, in nanoseconds.
+    uint64_t flush_interval;
+
+    // Messages at or above this level are written immediately, along with everything buffered before them.
+    enum LogLevel flush_level;
+
     enum FileArchiveNumbering archive_numbering;
     enum FileArchiveTiming archive_timing;
 
@@ -71,1956 +286,7239 @@ struct LogFileTargetContext {
 
     int max_archive_files;
     int max_archive_days;
-
-    int buffer_mode;
-
-    bool keep_files_open;
-    bool custom_buffering;
 };
 
 static struct LogLayoutRendererFinder log_renderer_finder = { NULL, 0, 0 };
 
-// ========================
-// SECION: Layout Renderers
-// ========================
+// ==================
+// SECTION: Threading
+// ==================
 
-LOG_EXPORT bool mist_log_format_read_arg_name(char* text, size_t* start, size_t count, String* name) {
-    for(size_t iter = 0; iter < count; iter++) {
-        if(iter + 1 < count && text[*start] == '\\') {
-            switch(text[*start + 1]) {
-                case '\\':
-                    if(!string_append_cstr(name, "\\"))
-                        return false;
-                    iter += 2;
-                    continue;
-                case ':':
-                    if(!string_append_cstr(name, ":"))
-                        return false;
-                    iter += 2;
-                    continue;
-                case '=':
-                    if(!string_append_cstr(name, "="))
-                        return false;
-                    iter += 2;
-                    continue;
-                case '}':
-                    if(!string_append_cstr(name, "}"))
-                        return false;
-                    iter += 2;
-                    continue;
-            }
-        }
+#ifdef LOG_THREADS
 
-        switch(text[*start]) {
-            case ':':
-            case '=':
-                return true;
-        }
+typedef struct LogThread {
+#if defined(LOG_WINDOWS)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void (*run)(void* arg);
+    void* arg;
+} LogThread;
 
-        if(!string_append_cstr_part(name, text, *start, 1))
-            return false;
-        (*start)++;
-    }
+#if defined(LOG_WINDOWS)
 
-    return true;
+typedef SRWLOCK LogMutex;
+typedef CONDITION_VARIABLE LogCondition;
+
+// MSVC gives volatile reads acquire semantics and volatile writes release semantics,
+// so only the compiler needs to be kept from reordering around them.
+
+static inline size_t log_atomic_load_size(volatile size_t* value) {
+    size_t result = *value;
+    _ReadWriteBarrier();
+    return result;
 }
 
-LOG_EXPORT bool mist_log_format_read_arg_value(char* text, size_t* start, size_t count, bool as_format, String* value, struct LogFormat** format) {
-    if(as_format) {
-        *format = mist_log_parse_format(text, *start, count);
-        if(!(*format))
-            return false;
-        (*start) += count;
-        return true;
-    } else {
-        return mist_log_format_read_arg_name(text, start, count, value);
-    }
+static inline void log_atomic_store_size(volatile size_t* value, size_t desired) {
+    _ReadWriteBarrier();
+    *value = desired;
 }
 
-static bool log_message_append_uint(String* message, uint32_t number) {
-    // The maximum number of characters in a uint is 10 (UINT_MAX).
-    if(!string_reserve(message, string_size(message) + 10))
-        return false;
+static inline bool log_atomic_cas_size(volatile size_t* value, size_t expected, size_t desired) {
+    return InterlockedCompareExchangePointer((PVOID volatile*)value, (PVOID)desired, (PVOID)expected) == (PVOID)expected;
+}
 
-    size_t current_size = string_size(message);
-    size_t written = sprintf(string_cstr(message) + current_size, "%u", number);
+static inline size_t log_atomic_add_size(volatile size_t* value, size_t amount) {
+#ifdef _WIN64
+    return (size_t)InterlockedExchangeAdd64((volatile LONG64*)value, (LONG64)amount);
+#else
+    return (size_t)InterlockedExchangeAdd((volatile LONG*)value, (LONG)amount);
+#endif
+}
 
-    if(sso_string_is_long(message))
-        sso_string_long_set_size(message, current_size + written);
-    else
-        sso_string_short_set_size(message, current_size + written);
+static inline void* log_atomic_load_ptr(void* volatile* value) {
+    void* result = *value;
+    _ReadWriteBarrier();
+    return result;
+}
 
-    return true;
+static inline uint32_t log_atomic_load_u32(volatile uint32_t* value) {
+    uint32_t result = *value;
+    _ReadWriteBarrier();
+    return result;
 }
 
-static bool log_format_level(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    switch(log_level) {
-        case LOG_TRACE: return string_append_cstr(message, "Trace");
-        case LOG_DEBUG: return string_append_cstr(message, "Debug");
-        case LOG_INFO: return string_append_cstr(message, "Info");
-        case LOG_WARN: return string_append_cstr(message, "Warn");
-        case LOG_ERROR: return string_append_cstr(message, "Error");
-        case LOG_FATAL: return string_append_cstr(message, "Fatal");
-        default: return true;
-    }
+static inline bool log_atomic_cas_u32(volatile uint32_t* value, uint32_t expected, uint32_t desired) {
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, (LONG)desired, (LONG)expected) == expected;
 }
 
-static struct LogLayoutRenderer* log_renderer_create_level(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
+static inline uint32_t log_atomic_exchange_u32(volatile uint32_t* value, uint32_t desired) {
+    return (uint32_t)InterlockedExchange((volatile LONG*)value, (LONG)desired);
+}
 
-    renderer->append = log_format_level;
-    renderer->free = NULL;
-    renderer->ctx = NULL;
+static inline void log_atomic_store_ptr(void* volatile* value, void* desired) {
+    _ReadWriteBarrier();
+    *value = desired;
+}
 
-    return renderer;
+static inline void log_atomic_fence(void) {
+    MemoryBarrier();
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_level() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static inline void log_atomic_fence_acquire(void) {
+    _ReadWriteBarrier();
+}
 
-    creator->name = "level";
-    creator->create = log_renderer_create_level;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static DWORD WINAPI log_thread_main(LPVOID ptr) {
+    LogThread* thread = ptr;
+    thread->run(thread->arg);
+    return 0;
+}
 
-    return creator;
+static bool log_thread_start(LogThread* thread, void (*run)(void* arg), void* arg) {
+    thread->run = run;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, log_thread_main, thread, 0, NULL);
+    return thread->handle != NULL;
 }
 
-static bool log_format_text(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    return string_append_string(message, (String*)ctx);
+static void log_thread_join(LogThread* thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
 }
 
-static void log_format_text_free(void* ctx) {
-    free(ctx);
+static void log_thread_yield(void) {
+    SwitchToThread();
 }
 
-static bool log_format_date_time(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    struct LogFormatTime* time_format = ctx;
-    struct tm* time_info;
-    time_t raw_time;
-    time(&raw_time);
+static inline void log_cpu_relax(void) {
+    YieldProcessor();
+}
 
-    if(time_format->is_utc) {
-        time_info = gmtime(&raw_time);
-    } else {
-        time_info = localtime(&raw_time);
-    }
+// Sleeps while the value is still equal to expected, or until woken.
+static void log_futex_wait(volatile uint32_t* value, uint32_t expected) {
+    WaitOnAddress(value, &expected, sizeof(expected), INFINITE);
+}
 
-    size_t written = 0;
-    size_t reserve = 0;
-    size_t current_size = string_size(message);
-    do {
-        // If the formatting fails, make sure the string is properly terminated.
-        if(!string_reserve(message, string_size(message) + reserve)) {
-            string_cstr(message)[string_size(message)] = '\0';
-            return false;
-        }
+static void log_futex_wake(volatile uint32_t* value) {
+    WakeByAddressSingle((PVOID)value);
+}
 
-        // Offset the start by string_size so that it starts writing the date at the end of the string.
-        // The remaining size is the difference of the capacity of the string (including the null-terminating 
-        // character) and the current_size.
-        written = strftime(
-            string_cstr(message) + current_size, 
-            string_capacity(message) + 1 - current_size, 
-            string_data(&time_format->format), 
-            time_info);
+static bool log_mutex_init(LogMutex* mutex) {
+    InitializeSRWLock(mutex);
+    return true;
+}
 
-        // Makes sure the string grows at least one size up.
-        reserve = string_capacity(message) + 1;
-    }
-    while(written == 0);
+static void log_mutex_destroy(LogMutex* mutex) {
+}
 
-    if(sso_string_is_long(message))
-        sso_string_long_set_size(message, current_size + written);
-    else
-        sso_string_short_set_size(message, current_size + written);
+static void log_mutex_lock(LogMutex* mutex) {
+    AcquireSRWLockExclusive(mutex);
+}
 
+static void log_mutex_unlock(LogMutex* mutex) {
+    ReleaseSRWLockExclusive(mutex);
+}
+
+static bool log_condition_init(LogCondition* condition) {
+    InitializeConditionVariable(condition);
     return true;
 }
 
-static log_format_date_time_free(void* ctx) {
-    struct LogFormatTime* format_time = ctx;
-    string_free_resources(&format_time->format);
-    free(format_time);
+static void log_condition_destroy(LogCondition* condition) {
 }
 
-static struct LogLayoutRenderer* log_renderer_create_date_time(char* text, size_t start, size_t count, void* ctx) {
-    String arg_name = string_create("");
-    String arg_value = string_create("");
+static void log_condition_signal(LogCondition* condition) {
+    WakeConditionVariable(condition);
+}
 
-    struct LogFormatTime* format_time = calloc(1, sizeof(*format_time));
-    if(!format_time)
-        goto error;
+static void log_condition_broadcast(LogCondition* condition) {
+    WakeAllConditionVariable(condition);
+}
 
-    string_init(&format_time->format, "");
+static void log_condition_wait(LogCondition* condition, LogMutex* mutex, uint32_t milliseconds) {
+    SleepConditionVariableSRW(condition, mutex, milliseconds, 0);
+}
 
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        goto error;
+#else
 
-    renderer->ctx = format_time;
-    renderer->free = log_format_date_time_free;
-    renderer->append = log_format_date_time;
+typedef pthread_mutex_t LogMutex;
+typedef pthread_cond_t LogCondition;
 
-    size_t arg_start = start;
-    while(arg_start - start < count) {
-        string_clear(&arg_name);
-        if(!mist_log_format_read_arg_name(text, &arg_start, count - (arg_start - start), &arg_name))
-            break;
+static inline size_t log_atomic_load_size(volatile size_t* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
 
-        arg_start++;
+static inline void log_atomic_store_size(volatile size_t* value, size_t desired) {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
 
-        if(text[arg_start - 1] == '=') {
-            string_clear(&arg_value);
-            if(!mist_log_format_read_arg_value(text, &arg_start, count - (arg_start - start), false, &arg_value, NULL))
-                break;
-        }
+static inline bool log_atomic_cas_size(volatile size_t* value, size_t expected, size_t desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
 
-        if(string_equals_cstr(&arg_name, "utc")) {
-            if(string_size(&arg_value) == 0) {
-                format_time->is_utc = true;
-            } else {
-                format_time->is_utc = string_equals_cstr(&arg_value, "true");
-            }
-        } else if(string_equals_cstr(&arg_name, "format")) {
-            if(string_size(&arg_value) == 0)
-                continue;
+static inline size_t log_atomic_add_size(volatile size_t* value, size_t amount) {
+    return __atomic_fetch_add(value, amount, __ATOMIC_ACQ_REL);
+}
 
-            string_append_string(&format_time->format, &arg_value);
-        }
-    }
+static inline void* log_atomic_load_ptr(void* volatile* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
 
-    // If no date time format was specified, add a default format.
-    // The format is locale specific but looks something like:
-    // 08/23/01 14:55:02
-    if(string_size(&format_time->format) == 0) {
-        if(!string_append_cstr(&format_time->format, "%x %X"))
-            goto error;
-    }
+static inline uint32_t log_atomic_load_u32(volatile uint32_t* value) {
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
 
-    string_free_resources(&arg_value);
-    string_free_resources(&arg_name);
+static inline bool log_atomic_cas_u32(volatile uint32_t* value, uint32_t expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
-    return renderer;
+static inline uint32_t log_atomic_exchange_u32(volatile uint32_t* value, uint32_t desired) {
+    return __atomic_exchange_n(value, desired, __ATOMIC_ACQ_REL);
+}
 
-    error:
-        if(format_time != NULL) {
-            string_free_resources(&format_time->format); 
-            free(format_time);
-        }
+static inline void log_atomic_store_ptr(void* volatile* value, void* desired) {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
 
-        if(renderer) {
-            free(renderer);
-        }
+static inline void log_atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
 
-        string_free_resources(&arg_name);
-        string_free_resources(&arg_value);
+static inline void log_atomic_fence_acquire(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
 
-        return NULL;
+static void* log_thread_main(void* ptr) {
+    LogThread* thread = ptr;
+    thread->run(thread->arg);
+    return NULL;
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_date_time() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static bool log_thread_start(LogThread* thread, void (*run)(void* arg), void* arg) {
+    thread->run = run;
+    thread->arg = arg;
+    return pthread_create(&thread->handle, NULL, log_thread_main, thread) == 0;
+}
 
-    creator->name = "time";
-    creator->create = log_renderer_create_date_time;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static void log_thread_join(LogThread* thread) {
+    pthread_join(thread->handle, NULL);
+}
 
-    return creator;
+static void log_thread_yield(void) {
+    sched_yield();
 }
 
-static bool log_format_counter(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    return log_message_append_uint(message, ++(*(uint32_t*)ctx));
+static inline void log_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
 }
 
-static void log_format_counter_free(void* ctx) {
-    free(ctx);
+#ifdef __linux__
+
+// Sleeps while the value is still equal to expected, or until woken.
+static void log_futex_wait(volatile uint32_t* value, uint32_t expected) {
+    syscall(SYS_futex, value, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
 }
 
-static struct LogLayoutRenderer* log_renderer_create_counter(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
+static void log_futex_wake(volatile uint32_t* value) {
+    syscall(SYS_futex, value, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
 
-    uint32_t* counter = malloc(sizeof(*counter));
-    if(!counter) {
-        free(renderer);
-        return NULL;
-    }
+#else
 
-    *counter = 1;
-    renderer->append = log_format_counter;
-    renderer->free = log_format_counter_free;
-    renderer->ctx = counter;
+// Without futexes a sleeping thread just gives up its time slice until the value changes.
+static void log_futex_wait(volatile uint32_t* value, uint32_t expected) {
+    if(log_atomic_load_u32(value) == expected)
+        sched_yield();
+}
 
-    return renderer;
+static void log_futex_wake(volatile uint32_t* value) {
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_counter() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+#endif
 
-    creator->name = "counter";
-    creator->create = log_renderer_create_counter;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static bool log_mutex_init(LogMutex* mutex) {
+    return pthread_mutex_init(mutex, NULL) == 0;
+}
 
-    return creator;
+static void log_mutex_destroy(LogMutex* mutex) {
+    pthread_mutex_destroy(mutex);
 }
 
-static bool log_format_file(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    return string_append_cstr(message, file);
+static void log_mutex_lock(LogMutex* mutex) {
+    pthread_mutex_lock(mutex);
 }
 
-static struct LogLayoutRenderer* log_renderer_create_file(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
-    
-    renderer->append = log_format_file;
-    renderer->free = NULL;
-    renderer->ctx = NULL;
+static void log_mutex_unlock(LogMutex* mutex) {
+    pthread_mutex_unlock(mutex);
+}
 
-    return renderer;
+static bool log_condition_init(LogCondition* condition) {
+    return pthread_cond_init(condition, NULL) == 0;
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_file() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static void log_condition_destroy(LogCondition* condition) {
+    pthread_cond_destroy(condition);
+}
 
-    creator->name = "file";
-    creator->create = log_renderer_create_file;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static void log_condition_signal(LogCondition* condition) {
+    pthread_cond_signal(condition);
+}
 
-    return creator;
+static void log_condition_broadcast(LogCondition* condition) {
+    pthread_cond_broadcast(condition);
 }
 
-static bool log_format_function(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    return string_append_cstr(message, function);
+static void log_condition_wait(LogCondition* condition, LogMutex* mutex, uint32_t milliseconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(condition, mutex, &deadline);
 }
 
-static struct LogLayoutRenderer* log_renderer_create_function(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
-    
-    renderer->append = log_format_function;
-    renderer->free = NULL;
-    renderer->ctx = NULL;
+#endif
 
-    return renderer;
+#else // LOG_THREADS
+
+// Without threads the atomic helpers are plain memory accesses.
+
+static inline size_t log_atomic_load_size(volatile size_t* value) {
+    return *value;
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_function() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static inline void log_atomic_store_size(volatile size_t* value, size_t desired) {
+    *value = desired;
+}
 
-    creator->name = "function";
-    creator->create = log_renderer_create_function;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static inline bool log_atomic_cas_size(volatile size_t* value, size_t expected, size_t desired) {
+    if(*value != expected)
+        return false;
 
-    return creator;
+    *value = desired;
+    return true;
 }
 
-static bool log_format_line(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    return log_message_append_uint(message, line);
+static inline size_t log_atomic_add_size(volatile size_t* value, size_t amount) {
+    size_t result = *value;
+    *value += amount;
+    return result;
 }
 
-static struct LogLayoutRenderer* log_renderer_create_line(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
-    
-    renderer->append = log_format_line;
-    renderer->free = NULL;
-    renderer->ctx = NULL;
+static inline void* log_atomic_load_ptr(void* volatile* value) {
+    return *value;
+}
 
-    return renderer;
+static inline void log_atomic_store_ptr(void* volatile* value, void* desired) {
+    *value = desired;
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_line() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static inline void log_atomic_fence(void) {
+}
 
-    creator->name = "line";
-    creator->create = log_renderer_create_line;
-    creator->ctx = NULL;
-    creator->free = NULL;
+static inline void log_atomic_fence_acquire(void) {
+}
 
-    return creator;
+static inline uint32_t log_atomic_load_u32(volatile uint32_t* value) {
+    return *value;
 }
 
-static bool log_format_message(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* message, void *ctx, char* format, va_list args) {
-    va_list copy;
-    va_copy(copy, args);
+static inline bool log_atomic_cas_u32(volatile uint32_t* value, uint32_t expected, uint32_t desired) {
+    if(*value != expected)
+        return false;
 
-    String* result = string_format_args_cstr(message, format, args);
+    *value = desired;
+    return true;
+}
 
-    va_end(copy);
+static inline uint32_t log_atomic_exchange_u32(volatile uint32_t* value, uint32_t desired) {
+    uint32_t result = *value;
+    *value = desired;
+    return result;
+}
 
-    return result != NULL;
+static void log_thread_yield(void) {
 }
 
-static struct LogLayoutRenderer* log_renderer_create_message(char* text, size_t start, size_t count, void* ctx) {
-    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
-    if(!renderer)
-        return NULL;
-    
-    renderer->append = log_format_message;
-    renderer->free = NULL;
-    renderer->ctx = NULL;
+static inline void log_cpu_relax(void) {
+}
 
-    return renderer;
+static void log_futex_wait(volatile uint32_t* value, uint32_t expected) {
 }
 
-static struct LogLayoutRendererCreator* log_layout_renderer_creator_message() {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return NULL;
+static void log_futex_wake(volatile uint32_t* value) {
+}
 
-    creator->name = "message";
-    creator->create = log_renderer_create_message;
-    creator->ctx = NULL;
-    creator->free = NULL;
+#endif // LOG_THREADS
 
-    return creator;
+// A minimal lock for state that is only changed rarely, e.g. when the configuration changes.
+
+static void log_spin_lock(volatile size_t* lock) {
+    while(!log_atomic_cas_size(lock, 0, 1))
+        log_thread_yield();
 }
 
-static bool log_format_finder_init() {
-    if(log_renderer_finder.capacity != 0)
-        return true;
+static void log_spin_unlock(volatile size_t* lock) {
+    log_atomic_store_size(lock, 0);
+}
 
-    size_t capacity = 16;
-    size_t count = 0;
+// The lock built into every target. Its state is 0 while unlocked, 1 while locked and 2 while locked with
+// threads (possibly) sleeping on it. A contended lock is polled for a short while first, since messages are
+// usually written quickly, and only then does the thread sleep until the lock is released.
 
-    log_renderer_finder.registered_creators = calloc(capacity, sizeof(*log_renderer_finder.registered_creators));
+static void log_lock_acquire(volatile uint32_t* state) {
+    if(log_atomic_cas_u32(state, 0, 1))
+        return;
 
+    for(int i = 0; i < LOG_LOCK_SPIN_COUNT; i++) {
+        log_cpu_relax();
+        if(log_atomic_load_u32(state) == 0 && log_atomic_cas_u32(state, 0, 1))
+            return;
+    }
 
-    if(!log_renderer_finder.registered_creators)
-        goto error;
+    while(log_atomic_exchange_u32(state, 2) != 0)
+        log_futex_wait(state, 2);
+}
 
-    log_renderer_finder.capacity = capacity;
+static void log_lock_release(volatile uint32_t* state) {
+    if(log_atomic_exchange_u32(state, 0) == 2)
+        log_futex_wake(state);
+}
 
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_level();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
+static bool log_lock_try_acquire(volatile uint32_t* state) {
+    return log_atomic_cas_u32(state, 0, 1);
+}
 
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_date_time();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
+/**
+ * Buffers that are reused by every log call made on the same thread, so that formatting
+ * doesn't need to allocate once the buffers have grown large enough.
+ */
+struct LogThreadBuffers {
+    // The rendered output of a target's layout.
+    String output;
 
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_counter();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
+    // The user's message with its arguments applied.
+    String message;
 
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_file();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
-        
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_function();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
-        
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_line();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
-        
-    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_message();
-    if(!log_renderer_finder.registered_creators[count++])
-        goto error;
+    // The rendered name of the file a file target writes to.
+    String file_name;
 
-    log_renderer_finder.count = count;
+    // The record that marks the thread while it reads logger snapshots. NULL until the thread first reads one.
+    struct LogReader* reader;
 
-    return true;
+    bool initialized;
 
-    error:
-        for(int i = 0; i < count; i++) {
-            struct LogLayoutRendererCreator* creator = log_renderer_finder.registered_creators[i];
-            if(creator->free != NULL)
-                creator->free(creator->ctx);
-            free(creator);
-        }
+    // Set while a log call is using the buffers, in case a target logs from inside a log call.
+    bool in_use;
+};
 
-        free(log_renderer_finder.registered_creators);
-        return false;
-}
+/**
+ * Marks a thread that reads logger snapshots, so that replaced snapshots aren't freed while it may still use them.
+ * Records are never freed, but are reused once the thread that claimed them exits.
+ */
+struct LogReader {
+    // The epoch the thread's current read section started in, or 0 while the thread isn't reading.
+    volatile size_t epoch;
 
-LOG_EXPORT bool mist_log_register_log_format_creator(const char* name, struct LogLayoutRenderer* (*create)(char* text, size_t start, size_t count, void* ctx), void* ctx, void (*free)(void* ctx)) {
-    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
-    if(!creator)
-        return false;
+    // Set while the record belongs to a thread.
+    volatile size_t in_use;
 
-    creator->name = name;
-    creator->create = create;
-    creator->ctx = ctx;
-    creator->free = free;
+    // The number of nested read sections. Only used by the thread that owns the record.
+    size_t depth;
 
-    if(log_renderer_finder.count == log_renderer_finder.capacity) {
-        size_t capacity = log_renderer_finder.capacity * 2;
-        void* buffer = realloc(log_renderer_finder.registered_creators, sizeof(*log_renderer_finder.registered_creators));
-        if(!buffer) {
-            free(creator);
-            return false;
-        }
-        log_renderer_finder.registered_creators = buffer;
-        log_renderer_finder.capacity = capacity;
+    struct LogReader* next;
+};
+
+static LOG_THREAD_LOCAL struct LogThreadBuffers log_thread_buffers;
+
+static void log_reader_release(struct LogReader* reader);
+
+static void log_thread_buffers_destroy(void* ptr) {
+    struct LogThreadBuffers* buffers = ptr;
+    if(!buffers || !buffers->initialized)
+        return;
+
+    string_free_resources(&buffers->output);
+    string_free_resources(&buffers->message);
+    string_free_resources(&buffers->file_name);
+
+    if(buffers->reader) {
+        log_reader_release(buffers->reader);
+        buffers->reader = NULL;
     }
 
-    log_renderer_finder.registered_creators[log_renderer_finder.count++] = creator;
-    return true;
+    buffers->initialized = false;
 }
 
-static struct LogLayoutRenderer* mist_log_create_renderer(char* format, size_t start, size_t count) {
-    size_t name_length = 0;
-    for(int i = 0; i < count; i++) {
-        if(format[i + start] == ':') {
-            if(i != count && format[i + start + 1] == ':') {
-                i += 2;
+#if defined(LOG_WINDOWS)
+
+static INIT_ONCE log_thread_buffers_once = INIT_ONCE_STATIC_INIT;
+static DWORD log_thread_buffers_key = FLS_OUT_OF_INDEXES;
+
+static void WINAPI log_thread_buffers_fls_callback(PVOID ptr) {
+    log_thread_buffers_destroy(ptr);
+}
+
+static BOOL CALLBACK log_thread_buffers_key_create(PINIT_ONCE once, PVOID parameter, PVOID* context) {
+    log_thread_buffers_key = FlsAlloc(log_thread_buffers_fls_callback);
+    return TRUE;
+}
+
+#elif defined(LOG_GCC)
+
+static pthread_once_t log_thread_buffers_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_thread_buffers_key;
+static bool log_thread_buffers_key_valid = false;
+
+static void log_thread_buffers_key_create(void) {
+    log_thread_buffers_key_valid = pthread_key_create(&log_thread_buffers_key, log_thread_buffers_destroy) == 0;
+}
+
+#endif
+
+/**
+ * Gets the buffers of the calling thread, initializing them on first use. Returns NULL if they couldn't be initialized.
+ */
+static struct LogThreadBuffers* log_thread_buffers_get(void) {
+    struct LogThreadBuffers* buffers = &log_thread_buffers;
+
+    if(!buffers->initialized) {
+        if(!string_init(&buffers->output, ""))
+            return NULL;
+
+        if(!string_init(&buffers->message, "")) {
+            string_free_resources(&buffers->output);
+            return NULL;
+        }
+
+        if(!string_init(&buffers->file_name, "")) {
+            string_free_resources(&buffers->output);
+            string_free_resources(&buffers->message);
+            return NULL;
+        }
+
+        // Register the buffers to be freed when the thread exits.
+#if defined(LOG_WINDOWS)
+        InitOnceExecuteOnce(&log_thread_buffers_once, log_thread_buffers_key_create, NULL, NULL);
+        if(log_thread_buffers_key != FLS_OUT_OF_INDEXES)
+            FlsSetValue(log_thread_buffers_key, buffers);
+#elif defined(LOG_GCC)
+        pthread_once(&log_thread_buffers_once, log_thread_buffers_key_create);
+        if(log_thread_buffers_key_valid)
+            pthread_setspecific(log_thread_buffers_key, buffers);
+#endif
+
+        buffers->initialized = true;
+    }
+
+    return buffers;
+}
+
+/**
+ * Gets the buffers of the calling thread for use by a log call, or NULL if they are already in use further up the stack.
+ */
+static struct LogThreadBuffers* log_thread_buffers_acquire(void) {
+    struct LogThreadBuffers* buffers = log_thread_buffers_get();
+    if(!buffers || buffers->in_use)
+        return NULL;
+
+    buffers->in_use = true;
+    return buffers;
+}
+
+static void log_thread_buffers_release(struct LogThreadBuffers* buffers) {
+    if(buffers)
+        buffers->in_use = false;
+}
+
+// Every reader record that was ever claimed. Only changed while holding log_readers_lock.
+static struct LogReader* log_readers = NULL;
+static volatile size_t log_readers_lock = 0;
+
+// Incremented every time a snapshot is replaced. Starts at 1 so that 0 can mean "not reading".
+static volatile size_t log_epoch = 1;
+
+static struct LogReader* log_reader_claim(void) {
+    log_spin_lock(&log_readers_lock);
+
+    struct LogReader* reader = log_readers;
+    while(reader && !log_atomic_cas_size(&reader->in_use, 0, 1))
+        reader = reader->next;
+
+    if(!reader) {
+        reader = calloc(1, sizeof(*reader));
+        if(reader) {
+            reader->in_use = 1;
+            reader->next = log_readers;
+            log_readers = reader;
+        }
+    }
+
+    log_spin_unlock(&log_readers_lock);
+    return reader;
+}
+
+static void log_reader_release(struct LogReader* reader) {
+    reader->depth = 0;
+    log_atomic_store_size(&reader->epoch, 0);
+    log_atomic_store_size(&reader->in_use, 0);
+}
+
+/**
+ * Gets the reader record of the calling thread, claiming one on first use. Returns NULL if it couldn't be claimed.
+ */
+static struct LogReader* log_reader_get(void) {
+    struct LogThreadBuffers* buffers = log_thread_buffers_get();
+    if(!buffers)
+        return NULL;
+
+    if(!buffers->reader)
+        buffers->reader = log_reader_claim();
+
+    return buffers->reader;
+}
+
+/**
+ * Starts a section in which the calling thread may use logger snapshots. Sections can be nested.
+ */
+static struct LogReader* log_read_begin(void) {
+    struct LogReader* reader = log_reader_get();
+    if(reader && reader->depth++ == 0) {
+        log_atomic_store_size(&reader->epoch, log_atomic_load_size(&log_epoch));
+
+        // The epoch has to be visible before any snapshot is loaded, otherwise a writer could miss the reader.
+        log_atomic_fence();
+    }
+
+    return reader;
+}
+
+static void log_read_end(struct LogReader* reader) {
+    if(reader && --reader->depth == 0)
+        log_atomic_store_size(&reader->epoch, 0);
+}
+
+/**
+ * Determines if every reader has left the sections that started in or before an epoch.
+ * Readers that are still in such a section are waited for when wait is true.
+ *
+ * @remarks The calling thread's own section is never waited for.
+ */
+static bool log_readers_quiescent(size_t epoch, bool wait) {
+    struct LogReader* self = log_reader_get();
+
+    // Pairs with the fence in log_read_begin. Either the reader's epoch is seen here,
+    // or the reader sees the snapshot that replaced the retired one.
+    log_atomic_fence();
+
+    // Records are only ever added to the front of the list, so the rest of it can be walked without the lock,
+    // which threads claiming their first record need. Records added after this claim them after the epoch changed.
+    log_spin_lock(&log_readers_lock);
+    struct LogReader* readers = log_readers;
+    log_spin_unlock(&log_readers_lock);
+
+    bool quiescent = true;
+    for(struct LogReader* reader = readers; reader; reader = reader->next) {
+        if(reader == self)
+            continue;
+
+        while(true) {
+            size_t reader_epoch = log_atomic_load_size(&reader->epoch);
+            if(reader_epoch == 0 || reader_epoch > epoch)
+                break;
+
+            if(!wait) {
+                quiescent = false;
+                break;
+            }
+
+            log_thread_yield();
+        }
+
+        if(!quiescent)
+            break;
+    }
+
+    return quiescent;
+}
+
+/**
+ * An immutable copy of the targets and levels used by a logger. Log calls load it with a single atomic read,
+ * and configuration changes replace it with a new copy instead of changing it.
+ */
+struct LogSnapshot {
+    // The levels accepted by at least one of the targets, limited to the logger's level.
+    unsigned int level_mask;
+
+    // The minimum level of the logger, either its own or the nearest parent's.
+    enum LogLevel level;
+
+    // The targets of the logger followed by the targets of its parents, grouped by format.
+    LogTarget** targets;
+    int target_count;
+
+    // The logger the snapshot was built for. Only used until it's published.
+    Logger* logger;
+
+    // The following are only used once the snapshot has been replaced.
+
+    // The last epoch in which a reader could have loaded the snapshot.
+    size_t retired_epoch;
+
+    // The logger at the top of the tree, whose queue may still hold messages for the removed targets.
+    // NULL once the tree has been freed, which writes out everything that was queued.
+    Logger* root;
+
+    // Targets that were removed when the snapshot was replaced. Freed along with the snapshot.
+    LogTarget** removed;
+    int removed_count;
+
+    // Set once no reader can be using the snapshot.
+    bool quiescent;
+
+    // The position the root's queue has to reach before the removed targets can be freed.
+    size_t queue_position;
+
+    // The next snapshot in the list of new or replaced snapshots.
+    struct LogSnapshot* next;
+};
+
+// Held by every change to the configuration of any logger. Log calls never take it.
+static volatile size_t log_config_lock = 0;
+
+// Snapshots that have been replaced, but that readers may still be using. Only changed while holding log_config_lock.
+static struct LogSnapshot* log_snapshots_retired = NULL;
+
+static inline struct LogSnapshot* log_logger_snapshot(Logger* logger) {
+    return log_atomic_load_ptr((void* volatile*)&logger->snapshot);
+}
+
+/**
+ * Gets the current wall clock time in nanoseconds since the Unix epoch.
+ */
+static uint64_t log_time_now_ns(void) {
+#if defined(LOG_WINDOWS)
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+
+    ULARGE_INTEGER ull;
+    ull.LowPart = ft.dwLowDateTime;
+    ull.HighPart = ft.dwHighDateTime;
+
+    // FILETIME counts 100ns intervals since 1601.
+    return (ull.QuadPart - 116444736000000000ULL) * 100;
+#elif defined(LOG_GCC)
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#else
+    return (uint64_t)time(NULL) * 1000000000ULL;
+#endif
+}
+
+/**
+ * Gets the time of a clock that is never set, in nanoseconds since an arbitrary point.
+ */
+static uint64_t log_time_monotonic_ns(void) {
+#if defined(LOG_WINDOWS)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    uint64_t seconds = (uint64_t)(counter.QuadPart / frequency.QuadPart);
+    uint64_t rest = (uint64_t)(counter.QuadPart % frequency.QuadPart);
+    return seconds * 1000000000ULL + rest * 1000000000ULL / (uint64_t)frequency.QuadPart;
+#elif defined(LOG_GCC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#else
+    return (uint64_t)time(NULL) * 1000000000ULL;
+#endif
+}
+
+static volatile size_t log_event_sequence = 0;
+
+static LOG_THREAD_LOCAL uint64_t log_thread_id_value = 0;
+
+/**
+ * Gets an id for the calling thread that stays the same for the lifetime of the thread.
+ */
+static uint64_t log_thread_id(void) {
+#if defined(LOG_WINDOWS)
+    return GetCurrentThreadId();
+#elif defined(__linux__)
+    if(!log_thread_id_value)
+        log_thread_id_value = (uint64_t)syscall(SYS_gettid);
+    return log_thread_id_value;
+#elif defined(LOG_GCC)
+    return (uint64_t)(uintptr_t)pthread_self();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Fills in the parts of a LogEvent that are shared by every target. The message is rendered separately
+ * by log_event_render_message since layouts that don't use it can skip formatting it.
+ */
+static void log_event_init(
+    LogEvent* event,
+    enum LogLevel level,
+    const char* file,
+    const char* function,
+    uint32_t line,
+    const char* format,
+    va_list* args)
+{
+    event->level = level;
+    event->file = file;
+    event->function = function;
+    event->line = line;
+    event->site = NULL;
+    event->timestamp = log_time_now_ns();
+    event->thread_id = log_thread_id();
+    event->sequence = log_atomic_add_size(&log_event_sequence, 1);
+    event->message = NULL;
+    event->format = format;
+    event->args = args;
+}
+
+/**
+ * Renders the user's message of an event into buffer and points the event at it.
+ */
+static bool log_event_render_message(LogEvent* event, String* buffer) {
+    string_clear(buffer);
+
+    va_list copy;
+    va_copy(copy, *event->args);
+
+    bool result = string_format_args_cstr(buffer, event->format, copy) != NULL;
+
+    va_end(copy);
+
+    event->message = buffer;
+    return result;
+}
+
+// ========================
+// SECION: Layout Renderers
+// ========================
+
+LOG_EXPORT bool mist_log_format_read_arg_name(char* text, size_t* start, size_t count, String* name) {
+    for(size_t iter = 0; iter < count; iter++) {
+        if(iter + 1 < count && text[*start] == '\\') {
+            switch(text[*start + 1]) {
+                case '\\':
+                    if(!string_append_cstr(name, "\\"))
+                        return false;
+                    iter += 2;
+                    continue;
+                case ':':
+                    if(!string_append_cstr(name, ":"))
+                        return false;
+                    iter += 2;
+                    continue;
+                case '=':
+                    if(!string_append_cstr(name, "="))
+                        return false;
+                    iter += 2;
+                    continue;
+                case '}':
+                    if(!string_append_cstr(name, "}"))
+                        return false;
+                    iter += 2;
+                    continue;
+            }
+        }
+
+        switch(text[*start]) {
+            case ':':
+            case '=':
+                return true;
+        }
+
+        if(!string_append_cstr_part(name, text, *start, 1))
+            return false;
+        (*start)++;
+    }
+
+    return true;
+}
+
+LOG_EXPORT bool mist_log_format_read_arg_value(char* text, size_t* start, size_t count, bool as_format, String* value, struct LogFormat** format) {
+    if(as_format) {
+        *format = mist_log_parse_format(text, *start, count);
+        if(!(*format))
+            return false;
+        (*start) += count;
+        return true;
+    } else {
+        return mist_log_format_read_arg_name(text, start, count, value);
+    }
+}
+
+static const char log_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes exactly count decimal digits of value to output, padding with zeros.
+static void log_write_digits(char* output, uint32_t value, int count) {
+    while(count >= 2) {
+        count -= 2;
+        memcpy(output + count, log_digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+
+    if(count)
+        output[0] = (char)('0' + value % 10);
+}
+
+static bool log_message_append_uint(String* message, uint32_t number) {
+    // The maximum number of characters in a uint is 10 (UINT_MAX).
+    char digits[10];
+    int count = 1;
+    for(uint32_t value = number; value >= 10; value /= 10)
+        count++;
+
+    log_write_digits(digits, number, count);
+    return string_append_cstr_part(message, digits, 0, count);
+}
+
+static bool log_format_level(const LogEvent* event, String* message, void* ctx) {
+    switch(event->level) {
+        case LOG_TRACE: return string_append_cstr(message, "Trace");
+        case LOG_DEBUG: return string_append_cstr(message, "Debug");
+        case LOG_INFO: return string_append_cstr(message, "Info");
+        case LOG_WARN: return string_append_cstr(message, "Warn");
+        case LOG_ERROR: return string_append_cstr(message, "Error");
+        case LOG_FATAL: return string_append_cstr(message, "Fatal");
+        default: return true;
+    }
+}
+
+static struct LogLayoutRenderer* log_renderer_create_level(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+
+    renderer->append = NULL;
+    renderer->append_event = log_format_level;
+    renderer->free = NULL;
+    renderer->ctx = NULL;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_level() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "level";
+    creator->create = log_renderer_create_level;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_text(const LogEvent* event, String* message, void* ctx) {
+    return string_append_string(message, (String*)ctx);
+}
+
+static void log_format_text_free(void* ctx) {
+    free(ctx);
+}
+
+static bool log_time_to_tm(time_t time, bool is_utc, struct tm* result) {
+#if defined(LOG_WINDOWS)
+    return (is_utc ? gmtime_s(result, &time) : localtime_s(result, &time)) == 0;
+#elif defined(LOG_GCC)
+    return (is_utc ? gmtime_r(&time, result) : localtime_r(&time, result)) != NULL;
+#else
+    struct tm* value = is_utc ? gmtime(&time) : localtime(&time);
+    if(!value)
+        return false;
+
+    *result = *value;
+    return true;
+#endif
+}
+
+static bool log_format_date_time_uncached(struct LogFormatTime* time_format, struct tm* time_info, String* message) {
+    size_t written = 0;
+    size_t reserve = 0;
+    size_t current_size = string_size(message);
+    do {
+        // If the formatting fails, make sure the string is properly terminated.
+        if(!string_reserve(message, string_size(message) + reserve)) {
+            string_cstr(message)[string_size(message)] = '\0';
+            return false;
+        }
+
+        // Offset the start by string_size so that it starts writing the date at the end of the string.
+        // The remaining size is the difference of the capacity of the string (including the null-terminating 
+        // character) and the current_size.
+        written = strftime(
+            string_cstr(message) + current_size, 
+            string_capacity(message) + 1 - current_size, 
+            string_data(&time_format->format), 
+            time_info);
+
+        // Makes sure the string grows at least one size up.
+        reserve = string_capacity(message) + 1;
+    }
+    while(written == 0);
+
+    if(sso_string_is_long(message))
+        sso_string_long_set_size(message, current_size + written);
+    else
+        sso_string_short_set_size(message, current_size + written);
+
+    return true;
+}
+
+static bool log_format_date_time(const LogEvent* event, String* message, void* ctx) {
+    struct LogFormatTime* time_format = ctx;
+    time_t now = (time_t)(event->timestamp / 1000000000ULL);
+    char text[LOG_TIME_CACHE_SIZE];
+
+    // Most messages are logged in the same second as the one before them, so reuse the text
+    // rendered for that second. The copy is only used if no thread rewrote the cache during it.
+    size_t sequence = log_atomic_load_size(&time_format->sequence);
+    if(!(sequence & 1) && time_format->cached_second == now) {
+        size_t length = time_format->cached_length;
+        memcpy(text, time_format->cached_text, sizeof(text));
+        log_atomic_fence_acquire();
+
+        if(log_atomic_load_size(&time_format->sequence) == sequence && length <= sizeof(text))
+            return string_append_cstr_part(message, text, 0, length);
+    }
+
+    struct tm time_info;
+    if(!log_time_to_tm(now, time_format->is_utc, &time_info))
+        return false;
+
+    size_t length = strftime(text, sizeof(text), string_data(&time_format->format), &time_info);
+    if(length == 0)
+        return log_format_date_time_uncached(time_format, &time_info, message);
+
+    // Only one thread refreshes the cache at a time. Any others just use the text they rendered.
+    if(!(sequence & 1) && log_atomic_cas_size(&time_format->sequence, sequence, sequence + 1)) {
+        memcpy(time_format->cached_text, text, length);
+        time_format->cached_length = length;
+        time_format->cached_second = now;
+        log_atomic_store_size(&time_format->sequence, sequence + 2);
+    }
+
+    return string_append_cstr_part(message, text, 0, length);
+}
+
+static void log_format_date_time_free(void* ctx) {
+    struct LogFormatTime* format_time = ctx;
+    string_free_resources(&format_time->format);
+    free(format_time);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_date_time(char* text, size_t start, size_t count, void* ctx) {
+    String arg_name = string_create("");
+    String arg_value = string_create("");
+
+    struct LogFormatTime* format_time = calloc(1, sizeof(*format_time));
+    if(!format_time)
+        goto error;
+
+    string_init(&format_time->format, "");
+    format_time->cached_second = (time_t)-1;
+
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        goto error;
+
+    renderer->ctx = format_time;
+    renderer->free = log_format_date_time_free;
+    renderer->append = NULL;
+    renderer->append_event = log_format_date_time;
+
+    size_t arg_start = start;
+    while(arg_start - start < count) {
+        string_clear(&arg_name);
+        if(!mist_log_format_read_arg_name(text, &arg_start, count - (arg_start - start), &arg_name))
+            break;
+
+        arg_start++;
+
+        if(text[arg_start - 1] == '=') {
+            string_clear(&arg_value);
+            if(!mist_log_format_read_arg_value(text, &arg_start, count - (arg_start - start), false, &arg_value, NULL))
+                break;
+        }
+
+        if(string_equals_cstr(&arg_name, "utc")) {
+            if(string_size(&arg_value) == 0) {
+                format_time->is_utc = true;
+            } else {
+                format_time->is_utc = string_equals_cstr(&arg_value, "true");
+            }
+        } else if(string_equals_cstr(&arg_name, "format")) {
+            if(string_size(&arg_value) == 0)
+                continue;
+
+            string_append_string(&format_time->format, &arg_value);
+        }
+    }
+
+    // If no date time format was specified, add a default format.
+    // The format is locale specific but looks something like:
+    // 08/23/01 14:55:02
+    if(string_size(&format_time->format) == 0) {
+        if(!string_append_cstr(&format_time->format, "%x %X"))
+            goto error;
+    }
+
+    string_free_resources(&arg_value);
+    string_free_resources(&arg_name);
+
+    return renderer;
+
+    error:
+        if(format_time != NULL) {
+            string_free_resources(&format_time->format); 
+            free(format_time);
+        }
+
+        if(renderer) {
+            free(renderer);
+        }
+
+        string_free_resources(&arg_name);
+        string_free_resources(&arg_value);
+
+        return NULL;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_date_time() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "time";
+    creator->create = log_renderer_create_date_time;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+// Converts days since 1970-01-01 into a proleptic gregorian date.
+static void log_civil_from_days(int64_t days, int* year, unsigned* month, unsigned* day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned day_of_era = (unsigned)(days - era * 146097);
+    unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    unsigned month_index = (5 * day_of_year + 2) / 153;
+
+    *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    *month = month_index < 10 ? month_index + 3 : month_index - 9;
+    *year = (int)(year_of_era + era * 400 + (*month <= 2));
+}
+
+// Converts a proleptic gregorian date into days since 1970-01-01.
+static int64_t log_days_from_civil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned year_of_era = (unsigned)(year - era * 400);
+    unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+// Renders the date, hour and time zone of the hour containing seconds into the timestamp cache layout.
+static bool log_timestamp_render_hour(
+    struct LogFormatTimestamp* timestamp,
+    int64_t seconds,
+    int64_t* hour_start,
+    char* prefix,
+    char* zone,
+    size_t* zone_length)
+{
+    // The local offset is only looked up once per hour, so localtime never runs on the hot path.
+    int64_t offset = 0;
+    if(!timestamp->is_utc) {
+        struct tm time_info;
+        if(!log_time_to_tm((time_t)seconds, false, &time_info))
+            return false;
+
+        int64_t local = log_days_from_civil(time_info.tm_year + 1900, time_info.tm_mon + 1, time_info.tm_mday) * 86400
+            + time_info.tm_hour * 3600
+            + time_info.tm_min * 60
+            + time_info.tm_sec;
+
+        offset = local - seconds;
+    }
+
+    int64_t local = seconds + offset;
+    int64_t days = local / 86400;
+    int64_t second_of_day = local % 86400;
+    if(second_of_day < 0) {
+        second_of_day += 86400;
+        days--;
+    }
+
+    int year;
+    unsigned month, day;
+    log_civil_from_days(days, &year, &month, &day);
+    if(year < 0 || year > 9999)
+        return false;
+
+    log_write_digits(prefix, (uint32_t)year, 4);
+    prefix[4] = '-';
+    log_write_digits(prefix + 5, month, 2);
+    prefix[7] = '-';
+    log_write_digits(prefix + 8, day, 2);
+    prefix[10] = 'T';
+    log_write_digits(prefix + 11, (uint32_t)(second_of_day / 3600), 2);
+    prefix[13] = ':';
+
+    if(timestamp->is_utc) {
+        zone[0] = 'Z';
+        *zone_length = 1;
+    } else {
+        int64_t minutes = offset < 0 ? -offset / 60 : offset / 60;
+        zone[0] = offset < 0 ? '-' : '+';
+        log_write_digits(zone + 1, (uint32_t)(minutes / 60), 2);
+        zone[3] = ':';
+        log_write_digits(zone + 4, (uint32_t)(minutes % 60), 2);
+        *zone_length = 6;
+    }
+
+    *hour_start = seconds - second_of_day % 3600;
+    return true;
+}
+
+static bool log_format_timestamp(const LogEvent* event, String* message, void* ctx) {
+    struct LogFormatTimestamp* timestamp = ctx;
+    uint64_t now = event->timestamp;
+    int64_t seconds = (int64_t)(now / 1000000000ULL);
+    uint32_t nanoseconds = (uint32_t)(now % 1000000000ULL);
+
+    // "YYYY-MM-DDTHH:MM:SS.fffffffff+HH:MM"
+    char text[LOG_TIMESTAMP_PREFIX_SIZE + 15 + LOG_TIMESTAMP_ZONE_SIZE];
+    char zone[LOG_TIMESTAMP_ZONE_SIZE];
+    size_t zone_length = 0;
+    int64_t hour_start = 0;
+    bool cached = false;
+
+    // The date, hour and time zone only change once an hour, so they are shared between threads
+    // the same way as the ${time} cache. Only the minutes and below are rendered per call.
+    size_t sequence = log_atomic_load_size(&timestamp->sequence);
+    if(!(sequence & 1)) {
+        hour_start = timestamp->hour_start;
+        zone_length = timestamp->zone_length;
+        memcpy(text, timestamp->prefix, LOG_TIMESTAMP_PREFIX_SIZE);
+        memcpy(zone, timestamp->zone, LOG_TIMESTAMP_ZONE_SIZE);
+        log_atomic_fence_acquire();
+
+        cached = log_atomic_load_size(&timestamp->sequence) == sequence
+            && seconds >= hour_start
+            && seconds - hour_start < 3600
+            && zone_length <= LOG_TIMESTAMP_ZONE_SIZE;
+    }
+
+    if(!cached) {
+        if(!log_timestamp_render_hour(timestamp, seconds, &hour_start, text, zone, &zone_length))
+            return false;
+
+        if(!(sequence & 1) && log_atomic_cas_size(&timestamp->sequence, sequence, sequence + 1)) {
+            memcpy(timestamp->prefix, text, LOG_TIMESTAMP_PREFIX_SIZE);
+            memcpy(timestamp->zone, zone, LOG_TIMESTAMP_ZONE_SIZE);
+            timestamp->zone_length = zone_length;
+            timestamp->hour_start = hour_start;
+            log_atomic_store_size(&timestamp->sequence, sequence + 2);
+        }
+    }
+
+    uint32_t second_of_hour = (uint32_t)(seconds - hour_start);
+    size_t length = LOG_TIMESTAMP_PREFIX_SIZE;
+
+    log_write_digits(text + length, second_of_hour / 60, 2);
+    text[length + 2] = ':';
+    log_write_digits(text + length + 3, second_of_hour % 60, 2);
+    length += 5;
+
+    if(timestamp->precision > 0) {
+        static const uint32_t divisors[] = { 1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1 };
+
+        text[length++] = '.';
+        log_write_digits(text + length, nanoseconds / divisors[timestamp->precision], timestamp->precision);
+        length += timestamp->precision;
+    }
+
+    memcpy(text + length, zone, zone_length);
+    length += zone_length;
+
+    return string_append_cstr_part(message, text, 0, length);
+}
+
+static void log_format_timestamp_free(void* ctx) {
+    free(ctx);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_timestamp(char* text, size_t start, size_t count, void* ctx) {
+    String arg_name = string_create("");
+    String arg_value = string_create("");
+    struct LogLayoutRenderer* renderer = NULL;
+
+    struct LogFormatTimestamp* timestamp = calloc(1, sizeof(*timestamp));
+    if(!timestamp)
+        goto error;
+
+    // Millisecond precision and local time by default.
+    timestamp->precision = 3;
+    timestamp->hour_start = INT64_MAX;
+
+    renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        goto error;
+
+    renderer->ctx = timestamp;
+    renderer->free = log_format_timestamp_free;
+    renderer->append = NULL;
+    renderer->append_event = log_format_timestamp;
+
+    size_t arg_start = start;
+    while(arg_start - start < count) {
+        string_clear(&arg_name);
+        string_clear(&arg_value);
+        if(!mist_log_format_read_arg_name(text, &arg_start, count - (arg_start - start), &arg_name))
+            break;
+
+        arg_start++;
+
+        if(text[arg_start - 1] == '=') {
+            if(!mist_log_format_read_arg_value(text, &arg_start, count - (arg_start - start), false, &arg_value, NULL))
+                break;
+        }
+
+        if(string_equals_cstr(&arg_name, "utc")) {
+            if(string_size(&arg_value) == 0) {
+                timestamp->is_utc = true;
+            } else {
+                timestamp->is_utc = string_equals_cstr(&arg_value, "true");
+            }
+        } else if(string_equals_cstr(&arg_name, "precision")) {
+            if(string_equals_cstr(&arg_value, "s"))
+                timestamp->precision = 0;
+            else if(string_equals_cstr(&arg_value, "ms"))
+                timestamp->precision = 3;
+            else if(string_equals_cstr(&arg_value, "us"))
+                timestamp->precision = 6;
+            else if(string_equals_cstr(&arg_value, "ns"))
+                timestamp->precision = 9;
+        }
+    }
+
+    string_free_resources(&arg_value);
+    string_free_resources(&arg_name);
+
+    return renderer;
+
+    error:
+        free(timestamp);
+        free(renderer);
+
+        string_free_resources(&arg_name);
+        string_free_resources(&arg_value);
+
+        return NULL;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_timestamp() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "timestamp";
+    creator->create = log_renderer_create_timestamp;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_counter(const LogEvent* event, String* message, void* ctx) {
+    // Formatting happens outside of any lock, so the counter is shared between threads.
+    return log_message_append_uint(message, (uint32_t)log_atomic_add_size(ctx, 1));
+}
+
+static void log_format_counter_free(void* ctx) {
+    free(ctx);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_counter(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+
+    volatile size_t* counter = malloc(sizeof(*counter));
+    if(!counter) {
+        free(renderer);
+        return NULL;
+    }
+
+    *counter = 1;
+    renderer->append = NULL;
+    renderer->append_event = log_format_counter;
+    renderer->free = log_format_counter_free;
+    renderer->ctx = (void*)counter;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_counter() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "counter";
+    creator->create = log_renderer_create_counter;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_file(const LogEvent* event, String* message, void* ctx) {
+    return string_append_cstr(message, event->file);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_file(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+    
+    renderer->append = NULL;
+    renderer->append_event = log_format_file;
+    renderer->free = NULL;
+    renderer->ctx = NULL;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_file() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "file";
+    creator->create = log_renderer_create_file;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_function(const LogEvent* event, String* message, void* ctx) {
+    return string_append_cstr(message, event->function);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_function(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+    
+    renderer->append = NULL;
+    renderer->append_event = log_format_function;
+    renderer->free = NULL;
+    renderer->ctx = NULL;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_function() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "function";
+    creator->create = log_renderer_create_function;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_line(const LogEvent* event, String* message, void* ctx) {
+    return log_message_append_uint(message, event->line);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_line(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+    
+    renderer->append = NULL;
+    renderer->append_event = log_format_line;
+    renderer->free = NULL;
+    renderer->ctx = NULL;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_line() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "line";
+    creator->create = log_renderer_create_line;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_message(const LogEvent* event, String* message, void* ctx) {
+    return event->message == NULL || string_append_string(message, event->message);
+}
+
+static struct LogLayoutRenderer* log_renderer_create_message(char* text, size_t start, size_t count, void* ctx) {
+    struct LogLayoutRenderer* renderer = malloc(sizeof(*renderer));
+    if(!renderer)
+        return NULL;
+    
+    renderer->append = NULL;
+    renderer->append_event = log_format_message;
+    renderer->free = NULL;
+    renderer->ctx = NULL;
+
+    return renderer;
+}
+
+static struct LogLayoutRendererCreator* log_layout_renderer_creator_message() {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return NULL;
+
+    creator->name = "message";
+    creator->create = log_renderer_create_message;
+    creator->ctx = NULL;
+    creator->free = NULL;
+
+    return creator;
+}
+
+static bool log_format_finder_init() {
+    if(log_renderer_finder.capacity != 0)
+        return true;
+
+    size_t capacity = 16;
+    size_t count = 0;
+
+    log_renderer_finder.registered_creators = calloc(capacity, sizeof(*log_renderer_finder.registered_creators));
+
+
+    if(!log_renderer_finder.registered_creators)
+        goto error;
+
+    log_renderer_finder.capacity = capacity;
+
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_level();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_date_time();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_timestamp();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_counter();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_file();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+        
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_function();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+        
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_line();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+        
+    log_renderer_finder.registered_creators[count] = log_layout_renderer_creator_message();
+    if(!log_renderer_finder.registered_creators[count++])
+        goto error;
+
+    log_renderer_finder.count = count;
+
+    return true;
+
+    error:
+        for(int i = 0; i < count; i++) {
+            struct LogLayoutRendererCreator* creator = log_renderer_finder.registered_creators[i];
+            if(creator->free != NULL)
+                creator->free(creator->ctx);
+            free(creator);
+        }
+
+        free(log_renderer_finder.registered_creators);
+        return false;
+}
+
+LOG_EXPORT bool mist_log_register_log_format_creator(const char* name, struct LogLayoutRenderer* (*create)(char* text, size_t start, size_t count, void* ctx), void* ctx, void (*free)(void* ctx)) {
+    struct LogLayoutRendererCreator* creator = malloc(sizeof(*creator));
+    if(!creator)
+        return false;
+
+    creator->name = name;
+    creator->create = create;
+    creator->ctx = ctx;
+    creator->free = free;
+
+    if(log_renderer_finder.count == log_renderer_finder.capacity) {
+        size_t capacity = log_renderer_finder.capacity * 2;
+        void* buffer = realloc(log_renderer_finder.registered_creators, sizeof(*log_renderer_finder.registered_creators));
+        if(!buffer) {
+            free(creator);
+            return false;
+        }
+        log_renderer_finder.registered_creators = buffer;
+        log_renderer_finder.capacity = capacity;
+    }
+
+    log_renderer_finder.registered_creators[log_renderer_finder.count++] = creator;
+    return true;
+}
+
+static struct LogLayoutRenderer* mist_log_create_renderer(char* format, size_t start, size_t count) {
+    size_t name_length = 0;
+    for(int i = 0; i < count; i++) {
+        if(format[i + start] == ':') {
+            if(i != count && format[i + start + 1] == ':') {
+                i += 2;
+                continue;
+            }
+
+            break;
+        }
+
+        name_length++;
+    }
+
+    // Skip the ':' separating the name from the arguments, if there are any.
+    size_t args_start = name_length < count ? name_length + 1 : count;
+
+    for(int i = 0; i < log_renderer_finder.count; i++) {
+        struct LogLayoutRendererCreator* creator = log_renderer_finder.registered_creators[i];
+        if(strncmp(format + start, creator->name, name_length) == 0 && creator->name[name_length] == '\0') {
+            return creator->create(format, start + args_start, count - args_start, creator->ctx);
+        }
+    }
+
+    return NULL;
+}
+
+static struct LogLayoutRenderer* mist_log_create_text_renderer(char* format, size_t start, size_t count) {
+    String* part = string_create_ref("");
+    if(!part)
+        return NULL;
+
+    if(!string_append_cstr_part(part, format, start, count)) {
+        string_free(part);
+        return NULL;
+    }
+    struct LogLayoutRenderer* step = malloc(sizeof(*step));
+    if(!step) {
+        string_free(part);
+        return NULL;
+    }
+
+    step->ctx = part;
+    step->append = NULL;
+    step->append_event = log_format_text;
+    step->free = log_format_text_free;
+
+    return step;
+}
+
+// ===================
+// SECTION: Formatting
+// ===================
+
+enum LogFormatOpCode {
+    LOG_OP_TEXT,
+    LOG_OP_LEVEL,
+    LOG_OP_FILE,
+    LOG_OP_FUNCTION,
+    LOG_OP_LINE,
+    LOG_OP_MESSAGE,
+    LOG_OP_TIME,
+    LOG_OP_TIMESTAMP,
+    LOG_OP_COUNTER,
+    LOG_OP_CUSTOM
+};
+
+// A single instruction of a compiled LogFormat. LOG_OP_TEXT ops are followed by their text,
+// padded so that the next op stays aligned.
+struct LogFormatOp {
+    uint32_t code;
+    uint32_t length;
+    struct LogLayoutRenderer* renderer;
+};
+
+static const struct {
+    const char* text;
+    size_t length;
+} log_level_names[] = {
+    { "Trace", 5 },
+    { "Debug", 5 },
+    { "Info", 4 },
+    { "Warn", 4 },
+    { "Error", 5 },
+    { "Fatal", 5 }
+};
+
+static size_t log_format_op_size(size_t length) {
+    size_t alignment = _Alignof(struct LogFormatOp);
+    return sizeof(struct LogFormatOp) + (length + alignment - 1) / alignment * alignment;
+}
+
+static enum LogFormatOpCode log_format_op_code(struct LogLayoutRenderer* renderer) {
+    // Renderers using the original callback may not have set append_event at all.
+    if(renderer->append) return LOG_OP_CUSTOM;
+    if(renderer->append_event == log_format_text) return LOG_OP_TEXT;
+    if(renderer->append_event == log_format_level) return LOG_OP_LEVEL;
+    if(renderer->append_event == log_format_file) return LOG_OP_FILE;
+    if(renderer->append_event == log_format_function) return LOG_OP_FUNCTION;
+    if(renderer->append_event == log_format_line) return LOG_OP_LINE;
+    if(renderer->append_event == log_format_message) return LOG_OP_MESSAGE;
+    if(renderer->append_event == log_format_date_time) return LOG_OP_TIME;
+    if(renderer->append_event == log_format_timestamp) return LOG_OP_TIMESTAMP;
+    if(renderer->append_event == log_format_counter) return LOG_OP_COUNTER;
+    return LOG_OP_CUSTOM;
+}
+
+// Flattens the steps of a LogFormat into a single buffer of ops that mist_log_format can run
+// without chasing a pointer and making an indirect call for every step.
+static bool log_format_compile(struct LogFormat* log_format) {
+    size_t size = 0;
+    for(int i = 0; i < log_format->step_count; i++) {
+        struct LogLayoutRenderer* renderer = log_format->steps[i];
+        if(log_format_op_code(renderer) == LOG_OP_TEXT)
+            size += log_format_op_size(string_size((String*)renderer->ctx));
+        else
+            size += log_format_op_size(0);
+    }
+
+    unsigned char* program = malloc(size > 0 ? size : 1);
+    if(!program)
+        return false;
+
+    size_t offset = 0;
+    bool uses_message = false;
+    bool custom = false;
+    for(int i = 0; i < log_format->step_count; i++) {
+        struct LogLayoutRenderer* renderer = log_format->steps[i];
+        struct LogFormatOp* op = (struct LogFormatOp*)(program + offset);
+
+        op->code = log_format_op_code(renderer);
+        op->length = 0;
+        op->renderer = renderer;
+
+        // Custom renderers may read the message, so assume they do.
+        if(op->code == LOG_OP_MESSAGE || op->code == LOG_OP_CUSTOM)
+            uses_message = true;
+
+        if(op->code == LOG_OP_CUSTOM)
+            custom = true;
+
+        if(op->code == LOG_OP_TEXT) {
+            String* text = renderer->ctx;
+            op->length = (uint32_t)string_size(text);
+            memcpy(op + 1, string_data(text), op->length);
+        }
+
+        offset += log_format_op_size(op->length);
+    }
+
+    log_format->program = program;
+    log_format->program_size = size;
+    log_format->uses_message = uses_message;
+
+    // Custom renderers may keep state of their own, so they run under the target's lock the same as they did
+    // when every message was formatted under the logger's lock.
+    log_format->stateful = custom;
+
+    return true;
+}
+
+struct LogFormat* mist_log_parse_format(char* format, size_t start, size_t count) {
+    if (!log_format_finder_init())
+        return NULL;
+    // "${time:utc=true:format=%x %X} | ${upper:inner=${level}} ${level} | ${file} | ${message}";
+    size_t capacity = 2;
+    size_t renderer_count = 0;
+    struct LogLayoutRenderer** renderers = malloc(sizeof(*renderers) * capacity);
+    if(!renderers)
+        goto error;
+
+    size_t format_start = start;
+
+    for(size_t iter = 0; iter < count; iter++) {
+        size_t i = iter + start;
+        
+        // A layout renderer escape sequence has been detected. Start creating the renderer.
+        if(iter + 1 < count && format[i] == '$' && format[i + 1] == '{') {
+            // If there was any text before the layout renderer, create a raw
+            // text renderer containing it.
+            if(i != format_start) {
+
+                // Resize the renderers list if the capacity has been reached.
+                if(renderer_count == capacity) {
+                    capacity *= 2;
+                    void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
+                    if(!buffer)
+                        goto error;
+                    renderers = buffer;
+                }
+
+                struct LogLayoutRenderer* renderer = mist_log_create_text_renderer(format, format_start, i - format_start);
+                if (!renderer)
+                    goto error;
+                renderers[renderer_count++] = renderer;
+            }
+
+            iter += 2;
+            format_start = i + 2;
+            int brace_count = 1;
+            for(; iter < count; iter++) {
+                i = iter + start;
+                // Some renderers have inner renderers that need to be accounted for.
+                // This step makes sure braces are matched correctly accordingly.
+                if(iter + 1 < count && format[i] == '$' && format[i + 1] == '{') {
+                    brace_count++;
+                }
+
+                if(format[i] == '}') {
+                    // If all braces have been matched for the current layer, create a layout renderer
+                    // from the matched string.
+                    if(--brace_count == 0) {
+                        struct LogLayoutRenderer* renderer = mist_log_create_renderer(format, format_start, i - format_start);
+                        if(!renderer)
+                            goto error;
+                        
+                        // Resize the renderers list if the capacity has been reached.
+                        if(renderer_count == capacity) {
+                            capacity *= 2;
+                            void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
+                            if(!buffer)
+                                goto error;
+                            renderers = buffer;
+                        }
+
+                        renderers[renderer_count++] = renderer;
+                        break;
+                    }
+                }
+
+            }
+
+            format_start = i + 1;
+        }
+    }
+
+    // If there was any text at the end of the string, create a raw text
+    // renderer containing it.
+    if(format_start != start + count) {
+        // Resize the renderers list if the capacity has been reached.
+        if(renderer_count == capacity) {
+            capacity *= 2;
+            void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
+            if(!buffer)
+                goto error;
+            renderers = buffer;
+        }
+
+        struct LogLayoutRenderer* renderer = mist_log_create_text_renderer(format, format_start, start + count - format_start);
+        if(!renderer)
+            goto error;
+        renderers[renderer_count++] = renderer;
+    }
+
+    // Create the actual log format structure that will contain the layout renderers.
+    struct LogFormat* log_format = malloc(sizeof(*log_format));
+    if(!log_format)
+        goto error;
+
+    log_format->steps = renderers;
+    log_format->step_count = renderer_count;
+
+    if(!log_format_compile(log_format)) {
+        free(log_format);
+        goto error;
+    }
+
+    return log_format;
+
+    error:
+        if(renderers) {
+            for(int i = 0; i < renderer_count; i++) {
+                if(renderers[i]->free != NULL)
+                    renderers[i]->free(renderers[i]->ctx);
+                free(renderers[i]);
+            }
+
+            free(renderers);
+        }
+
+        return NULL;
+}
+
+LOG_EXPORT void mist_log_format_free(struct LogFormat* log_format) {
+    if(!log_format)
+        return;
+
+    for(size_t i = 0; i < log_format->step_count; i++) {
+        struct LogLayoutRenderer* renderer = log_format->steps[i];
+        if(renderer->free)
+            renderer->free(renderer->ctx);
+        free(renderer);
+    }
+    free(log_format->steps);
+    free(log_format->program);
+    free(log_format);
+}
+
+struct LogFormatInternEntry {
+    char* layout;
+    struct LogFormat* format;
+    size_t references;
+};
+
+// Target layouts that have already been parsed. Targets can be created by a configuration watcher and freed
+// once a replaced snapshot is reclaimed, so the table is guarded by log_format_interned_lock.
+static struct {
+    struct LogFormatInternEntry* entries;
+    size_t count;
+    size_t capacity;
+} log_format_interned = { NULL, 0, 0 };
+
+static volatile size_t log_format_interned_lock = 0;
+
+static struct LogFormat* log_format_intern_locked(const char* layout) {
+    for(size_t i = 0; i < log_format_interned.count; i++) {
+        struct LogFormatInternEntry* entry = log_format_interned.entries + i;
+        if(strcmp(entry->layout, layout) == 0) {
+            entry->references++;
+            return entry->format;
+        }
+    }
+
+    size_t length = strlen(layout);
+    char* copy = malloc(length + 1);
+    if(!copy)
+        return NULL;
+
+    memcpy(copy, layout, length + 1);
+
+    struct LogFormat* format = mist_log_parse_format(copy, 0, length);
+    if(!format) {
+        free(copy);
+        return NULL;
+    }
+
+    // Stateful formats are rendered under the lock of the target writing them, so each target needs its own
+    // renderers. log_format_release frees them directly since they aren't in the table.
+    if(format->stateful) {
+        free(copy);
+        return format;
+    }
+
+    if(log_format_interned.count == log_format_interned.capacity) {
+        size_t capacity = log_format_interned.capacity == 0 ? 4 : log_format_interned.capacity * 2;
+        void* buffer = realloc(log_format_interned.entries, sizeof(*log_format_interned.entries) * capacity);
+        if(!buffer) {
+            free(copy);
+            mist_log_format_free(format);
+            return NULL;
+        }
+
+        log_format_interned.entries = buffer;
+        log_format_interned.capacity = capacity;
+    }
+
+    struct LogFormatInternEntry* entry = log_format_interned.entries + log_format_interned.count++;
+    entry->layout = copy;
+    entry->format = format;
+    entry->references = 1;
+
+    return format;
+}
+
+// Parses a target layout, or returns the LogFormat already used by targets with the same layout. Layouts with
+// custom renderers are always parsed again.
+static struct LogFormat* log_format_intern(const char* layout) {
+    log_spin_lock(&log_format_interned_lock);
+    struct LogFormat* format = log_format_intern_locked(layout);
+    log_spin_unlock(&log_format_interned_lock);
+
+    return format;
+}
+
+// Releases a target's reference to its format. Formats that weren't interned are freed immediately.
+static void log_format_release(struct LogFormat* format) {
+    log_spin_lock(&log_format_interned_lock);
+
+    for(size_t i = 0; i < log_format_interned.count; i++) {
+        struct LogFormatInternEntry* entry = log_format_interned.entries + i;
+        if(entry->format != format)
+            continue;
+
+        if(--entry->references > 0) {
+            log_spin_unlock(&log_format_interned_lock);
+            return;
+        }
+
+        free(entry->layout);
+        *entry = log_format_interned.entries[--log_format_interned.count];
+        break;
+    }
+
+    log_spin_unlock(&log_format_interned_lock);
+
+    mist_log_format_free(format);
+}
+
+static bool log_renderer_append_rendered(struct LogLayoutRenderer* renderer, const LogEvent* event, String* output, ...) {
+    va_list args;
+    va_start(args, output);
+
+    bool result = renderer->append(event->level, event->file, event->function, event->line, output, renderer->ctx, "%s", args);
+
+    va_end(args);
+
+    return result;
+}
+
+static bool log_renderer_append(struct LogLayoutRenderer* renderer, const LogEvent* event, String* output) {
+    if(!renderer->append)
+        return renderer->append_event(event, output, renderer->ctx);
+
+    // Renderers using the original callback get their own copy of the user's arguments. Events
+    // that only have the rendered message pass it through a "%s" format instead.
+    if(event->args) {
+        va_list copy;
+        va_copy(copy, *event->args);
+
+        bool result = renderer->append(event->level, event->file, event->function, event->line, output, renderer->ctx, (char*)event->format, copy);
+
+        va_end(copy);
+
+        return result;
+    }
+
+    return log_renderer_append_rendered(renderer, event, output, event->message ? string_data(event->message) : "");
+}
+
+static bool log_format_run_program(struct LogFormat* log_format, const LogEvent* event, String* output) {
+    const unsigned char* program = log_format->program;
+    size_t offset = 0;
+
+    while(offset < log_format->program_size) {
+        const struct LogFormatOp* op = (const struct LogFormatOp*)(program + offset);
+        bool result;
+
+        switch(op->code) {
+            case LOG_OP_TEXT:
+                result = string_append_cstr_part(output, (const char*)(op + 1), 0, op->length);
+                break;
+            case LOG_OP_LEVEL:
+                result = event->level < sizeof(log_level_names) / sizeof(*log_level_names)
+                    ? string_append_cstr_part(output, log_level_names[event->level].text, 0, log_level_names[event->level].length)
+                    : true;
+                break;
+            case LOG_OP_FILE:
+                result = string_append_cstr(output, event->file);
+                break;
+            case LOG_OP_FUNCTION:
+                result = string_append_cstr(output, event->function);
+                break;
+            case LOG_OP_LINE:
+                result = log_message_append_uint(output, event->line);
+                break;
+            case LOG_OP_MESSAGE:
+                result = log_format_message(event, output, NULL);
+                break;
+            case LOG_OP_TIME:
+                result = log_format_date_time(event, output, op->renderer->ctx);
+                break;
+            case LOG_OP_TIMESTAMP:
+                result = log_format_timestamp(event, output, op->renderer->ctx);
+                break;
+            case LOG_OP_COUNTER:
+                result = log_format_counter(event, output, op->renderer->ctx);
+                break;
+            default:
+                result = log_renderer_append(op->renderer, event, output);
+                break;
+        }
+
+        if(!result) {
+            string_clear(output);
+            return false;
+        }
+
+        offset += log_format_op_size(op->length);
+    }
+
+    return true;
+}
+
+LOG_EXPORT bool mist_log_format_event(struct LogFormat* log_format, const LogEvent* event, String* output) {
+    if(log_format->program)
+        return log_format_run_program(log_format, event, output);
+
+    for(int i = 0; i < log_format->step_count; i++) {
+        if(!log_renderer_append(log_format->steps[i], event, output)) {
+            string_clear(output);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+LOG_EXPORT bool mist_log_format(struct LogFormat* log_format, enum LogLevel level, const char* file, const char* function, uint32_t line, String* message, char* format_string, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+
+    LogEvent event;
+    log_event_init(&event, level, file, function, line, format_string, &copy);
+
+    String user_message = string_create("");
+    bool result = true;
+    if(log_format->uses_message)
+        result = log_event_render_message(&event, &user_message);
+
+    result = result && mist_log_format_event(log_format, &event, message);
+
+    string_free_resources(&user_message);
+    va_end(copy);
+
+    return result;
+}
+
+/**
+ * Takes or releases the lock that protects writes to a target. That's the target's user lock if it has one,
+ * then the user lock of the logger at the top of the tree, and otherwise the target's built-in lock.
+ */
+static inline void log_target_lock(Logger* root, LogTarget* target, bool lock) {
+    if(target->mutex && target->lock)
+        target->lock(target->mutex, lock);
+    else if(root->mutex && root->lock)
+        root->lock(root->mutex, lock);
+    else if(!target->single_threaded && lock)
+        log_lock_acquire(&target->lock_state);
+    else if(!target->single_threaded)
+        log_lock_release(&target->lock_state);
+}
+
+/**
+ * Sends a rendered message to a target through whichever callback it implements.
+ */
+static void log_target_write(LogTarget* target, const LogEvent* event, String* output) {
+    if(target->log)
+        target->log(event->level, event->file, event->function, event->line, output, target->ctx);
+    else
+        target->log_event(event, output, target->ctx);
+}
+
+// ============================
+// SECTION: Deferred Formatting
+// ============================
+
+enum LogArgType {
+    LOG_ARG_NONE,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LONG_LONG,
+    LOG_ARG_INTMAX,
+    LOG_ARG_SIZE,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LONG_DOUBLE,
+    LOG_ARG_POINTER,
+    LOG_ARG_STRING,
+    LOG_ARG_UNSUPPORTED
+};
+
+/**
+ * A format string and its arguments packed into a byte buffer so they can be formatted later.
+ * 
+ * Every value is stored as a one byte LogArgType followed by its raw bytes. Strings are stored
+ * as their length followed by their characters and a null-terminating character.
+ */
+struct LogArgs {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+};
+
+/**
+ * A single conversion specification (e.g. "%-8.*lu") inside of a printf format string.
+ */
+struct LogFormatSpec {
+    size_t start;
+    size_t length;
+    int star_count;
+
+    // The precision written in the format, or -1 if there isn't one or it's passed as an argument.
+    int precision;
+
+    // Whether the precision is passed as an argument, in which case it's the last of the star arguments.
+    bool precision_star;
+
+    enum LogArgType type;
+};
+
+// Conversion specifications longer than this are formatted on the calling thread.
+#define LOG_FORMAT_SPEC_MAX 48
+
+static bool log_format_next_spec(const char* format, size_t* position, struct LogFormatSpec* spec) {
+    const char* start = strchr(format + *position, '%');
+    if(!start)
+        return false;
+
+    const char* iter = start + 1;
+    spec->start = start - format;
+    spec->star_count = 0;
+    spec->precision = -1;
+    spec->precision_star = false;
+
+    if(*iter == '%') {
+        spec->type = LOG_ARG_NONE;
+        spec->length = 2;
+        *position = spec->start + 2;
+        return true;
+    }
+
+    while(*iter && strchr("-+ #0'", *iter))
+        iter++;
+
+    if(*iter == '*') {
+        spec->star_count++;
+        iter++;
+    } else {
+        while(*iter >= '0' && *iter <= '9')
+            iter++;
+    }
+
+    if(*iter == '.') {
+        iter++;
+        if(*iter == '*') {
+            spec->star_count++;
+            spec->precision_star = true;
+            iter++;
+        } else {
+            spec->precision = 0;
+            while(*iter >= '0' && *iter <= '9') {
+                if(spec->precision < INT_MAX / 10)
+                    spec->precision = spec->precision * 10 + (*iter - '0');
+                iter++;
+            }
+        }
+    }
+
+    enum LogArgType integer_type = LOG_ARG_INT;
+    bool long_double = false;
+    bool wide = false;
+
+    switch(*iter) {
+        case 'h':
+            iter += iter[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            if(iter[1] == 'l') {
+                integer_type = LOG_ARG_LONG_LONG;
+                iter += 2;
+            } else {
+                integer_type = LOG_ARG_LONG;
+                wide = true;
+                iter++;
+            }
+            break;
+        case 'q':
+            integer_type = LOG_ARG_LONG_LONG;
+            iter++;
+            break;
+        case 'j':
+            integer_type = LOG_ARG_INTMAX;
+            iter++;
+            break;
+        case 'z':
+            integer_type = LOG_ARG_SIZE;
+            iter++;
+            break;
+        case 't':
+            integer_type = LOG_ARG_PTRDIFF;
+            iter++;
+            break;
+        case 'L':
+            long_double = true;
+            iter++;
+            break;
+    }
+
+    switch(*iter) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            spec->type = integer_type;
+            break;
+        case 'c':
+            spec->type = wide ? LOG_ARG_UNSUPPORTED : LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->type = long_double ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->type = wide ? LOG_ARG_UNSUPPORTED : LOG_ARG_STRING;
+            break;
+        case 'p':
+            spec->type = LOG_ARG_POINTER;
+            break;
+        default:
+            // Includes %n, which can't be deferred since it writes back to the caller.
+            spec->type = LOG_ARG_UNSUPPORTED;
+            break;
+    }
+
+    if(*iter)
+        iter++;
+
+    spec->length = iter - start;
+    if(spec->length >= LOG_FORMAT_SPEC_MAX)
+        spec->type = LOG_ARG_UNSUPPORTED;
+
+    *position = iter - format;
+    return true;
+}
+
+static bool log_args_reserve(struct LogArgs* args, size_t size) {
+    if(args->size + size <= args->capacity)
+        return true;
+
+    size_t capacity = args->capacity == 0 ? 64 : args->capacity * 2;
+    while(capacity < args->size + size)
+        capacity *= 2;
+
+    void* buffer = realloc(args->data, capacity);
+    if(!buffer)
+        return false;
+
+    args->data = buffer;
+    args->capacity = capacity;
+    return true;
+}
+
+static bool log_args_append(struct LogArgs* args, enum LogArgType type, const void* value, size_t size) {
+    if(!log_args_reserve(args, size + 1))
+        return false;
+
+    args->data[args->size++] = (unsigned char)type;
+    memcpy(args->data + args->size, value, size);
+    args->size += size;
+    return true;
+}
+
+static bool log_args_append_string(struct LogArgs* args, const char* value, size_t length) {
+    if(!log_args_reserve(args, 1 + sizeof(length) + length + 1))
+        return false;
+
+    args->data[args->size++] = LOG_ARG_STRING;
+    memcpy(args->data + args->size, &length, sizeof(length));
+    args->size += sizeof(length);
+    memcpy(args->data + args->size, value, length);
+    args->size += length;
+    args->data[args->size++] = '\0';
+    return true;
+}
+
+static void log_args_free_resources(struct LogArgs* args) {
+    free(args->data);
+    args->data = NULL;
+    args->size = 0;
+    args->capacity = 0;
+}
+
+/**
+ * Appends the arguments consumed by a format string to a LogArgs buffer.
+ * Fails without consuming the whole argument list if the format contains a conversion that can't be deferred.
+ */
+static bool log_args_pack_values(struct LogArgs* args, const char* format, va_list list) {
+    size_t position = 0;
+    struct LogFormatSpec spec;
+
+    while(log_format_next_spec(format, &position, &spec)) {
+        int precision = spec.precision;
+        for(int i = 0; i < spec.star_count; i++) {
+            int star = va_arg(list, int);
+            if(!log_args_append(args, LOG_ARG_INT, &star, sizeof(star)))
+                return false;
+
+            // A negative precision is the same as none.
+            if(spec.precision_star && i == spec.star_count - 1)
+                precision = star < 0 ? -1 : star;
+        }
+
+        bool result = true;
+        switch(spec.type) {
+            case LOG_ARG_NONE:
+                break;
+            case LOG_ARG_INT: {
+                int value = va_arg(list, int);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_LONG: {
+                long value = va_arg(list, long);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_LONG_LONG: {
+                long long value = va_arg(list, long long);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_INTMAX: {
+                intmax_t value = va_arg(list, intmax_t);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_SIZE: {
+                size_t value = va_arg(list, size_t);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_PTRDIFF: {
+                ptrdiff_t value = va_arg(list, ptrdiff_t);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double value = va_arg(list, double);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_LONG_DOUBLE: {
+                long double value = va_arg(list, long double);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                void* value = va_arg(list, void*);
+                result = log_args_append(args, spec.type, &value, sizeof(value));
+                break;
+            }
+            case LOG_ARG_STRING: {
+                const char* value = va_arg(list, const char*);
+                if(!value)
+                    value = "(null)";
+
+                // With a precision the string doesn't need to be terminated, so only that much of it is read.
+                size_t length = precision >= 0 ? strnlen(value, (size_t)precision) : strlen(value);
+                result = log_args_append_string(args, value, length);
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if(!result)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Copies a format string and the arguments it consumes into a LogArgs buffer.
+ */
+static bool log_args_pack(struct LogArgs* args, const char* format, va_list list) {
+    args->size = 0;
+    return log_args_append_string(args, format, strlen(format)) && log_args_pack_values(args, format, list);
+}
+
+/**
+ * Packs an already formatted message so that it renders back to itself.
+ */
+static bool log_args_pack_message(struct LogArgs* args, const char* message, size_t length) {
+    args->size = 0;
+    return log_args_append_string(args, "%s", 2) && log_args_append_string(args, message, length);
+}
+
+static bool log_args_read(const struct LogArgs* args, size_t* offset, enum LogArgType type, void* value, size_t size) {
+    if(*offset + 1 + size > args->size || args->data[*offset] != type)
+        return false;
+
+    memcpy(value, args->data + *offset + 1, size);
+    *offset += 1 + size;
+    return true;
+}
+
+static const char* log_args_read_string(const struct LogArgs* args, size_t* offset, size_t* length) {
+    if(!log_args_read(args, offset, LOG_ARG_STRING, length, sizeof(*length)))
+        return NULL;
+
+    if(*offset + *length + 1 > args->size)
+        return NULL;
+
+    const char* value = (const char*)args->data + *offset;
+    *offset += *length + 1;
+    return value;
+}
+
+/**
+ * Formats the message stored in a LogArgs buffer and appends it to message.
+ */
+static bool log_args_render(const struct LogArgs* args, String* message) {
+    size_t offset = 0;
+    size_t format_length;
+    const char* format = log_args_read_string(args, &offset, &format_length);
+    if(!format)
+        return false;
+
+    size_t position = 0;
+    size_t text_start = 0;
+    struct LogFormatSpec spec;
+    char spec_text[LOG_FORMAT_SPEC_MAX + 32];
+
+    while(log_format_next_spec(format, &position, &spec)) {
+        if(!string_append_cstr_part(message, format, text_start, spec.start - text_start))
+            return false;
+
+        text_start = position;
+
+        if(spec.type == LOG_ARG_NONE) {
+            if(!string_append_cstr(message, "%"))
+                return false;
+            continue;
+        }
+
+        // Rebuild the conversion specification with any '*' replaced by the stored width/precision
+        // so that the value can be formatted with a single argument.
+        size_t spec_length = 0;
+        for(size_t i = 0; i < spec.length; i++) {
+            char c = format[spec.start + i];
+            if(c == '*') {
+                int star;
+                if(!log_args_read(args, &offset, LOG_ARG_INT, &star, sizeof(star)))
+                    return false;
+
+                // A negative precision is the same as none, but can't be written into the specification.
+                if(star < 0 && spec_length > 0 && spec_text[spec_length - 1] == '.')
+                    spec_length--;
+                else
+                    spec_length += sprintf(spec_text + spec_length, "%d", star);
+            } else {
+                spec_text[spec_length++] = c;
+            }
+        }
+        spec_text[spec_length] = '\0';
+
+        String* result = NULL;
+        switch(spec.type) {
+            case LOG_ARG_INT: {
+                int value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_LONG: {
+                long value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_LONG_LONG: {
+                long long value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_INTMAX: {
+                intmax_t value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_SIZE: {
+                size_t value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_PTRDIFF: {
+                ptrdiff_t value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_LONG_DOUBLE: {
+                long double value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                void* value;
+                if(log_args_read(args, &offset, spec.type, &value, sizeof(value)))
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            case LOG_ARG_STRING: {
+                size_t length;
+                const char* value = log_args_read_string(args, &offset, &length);
+                if(value)
+                    result = string_format_cstr(message, spec_text, value);
+                break;
+            }
+            default:
+                break;
+        }
+
+        if(!result)
+            return false;
+    }
+
+    return string_append_cstr_part(message, format, text_start, format_length - text_start);
+}
+
+// ===================
+// SECTION: Call Sites
+// ===================
+
+struct LogSiteRule {
+    char* pattern;
+    enum LogLevel level;
+};
+
+// Every call site that has logged at least once, and the rules that override their levels.
+// Both are only changed while holding log_sites_lock.
+static struct LogSite* log_sites = NULL;
+static struct LogSiteRule* log_site_rules = NULL;
+static size_t log_site_rule_count = 0;
+static volatile size_t log_sites_lock = 0;
+
+// Matches text against a glob pattern supporting '*' and '?'.
+static bool log_glob_match(const char* pattern, const char* text) {
+    const char* star = NULL;
+    const char* resume = NULL;
+
+    while(*text) {
+        if(*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if(*pattern == '?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if(star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+
+    while(*pattern == '*')
+        pattern++;
+
+    return *pattern == '\0';
+}
+
+static bool log_site_matches(struct LogSite* site, const char* pattern) {
+    const char* name = site->file;
+    for(const char* c = site->file; *c; c++) {
+        if(*c == '/' || *c == '\\')
+            name = c + 1;
+    }
+
+    return log_glob_match(pattern, site->file)
+        || log_glob_match(pattern, name)
+        || log_glob_match(pattern, site->function);
+}
+
+// Sets the switches of a site from the rules. Must be called while holding log_sites_lock.
+static void log_site_apply_rules(struct LogSite* site) {
+    unsigned char keep = 1;
+    unsigned char force = 0;
+
+    for(size_t i = 0; i < log_site_rule_count; i++) {
+        if(log_site_matches(site, log_site_rules[i].pattern)) {
+            keep = site->level >= log_site_rules[i].level;
+            force = keep;
+        }
+    }
+
+    site->keep = keep;
+    site->force = force;
+}
+
+static void log_site_register(struct LogSite* site) {
+    log_spin_lock(&log_sites_lock);
+
+    if(!site->registered) {
+        log_site_apply_rules(site);
+        site->next = log_sites;
+        log_sites = site;
+        site->registered = 1;
+    }
+
+    log_spin_unlock(&log_sites_lock);
+}
+
+LOG_EXPORT bool mist_log_sites_set(const char* pattern, enum LogLevel level) {
+    size_t length = strlen(pattern);
+    char* copy = malloc(length + 1);
+    if(!copy)
+        return false;
+
+    memcpy(copy, pattern, length + 1);
+
+    log_spin_lock(&log_sites_lock);
+
+    void* buffer = realloc(log_site_rules, sizeof(*log_site_rules) * (log_site_rule_count + 1));
+    if(!buffer) {
+        log_spin_unlock(&log_sites_lock);
+        free(copy);
+        return false;
+    }
+
+    log_site_rules = buffer;
+    log_site_rules[log_site_rule_count].pattern = copy;
+    log_site_rules[log_site_rule_count].level = level;
+    log_site_rule_count++;
+
+    for(struct LogSite* site = log_sites; site; site = site->next)
+        log_site_apply_rules(site);
+
+    log_spin_unlock(&log_sites_lock);
+
+    return true;
+}
+
+LOG_EXPORT void mist_log_sites_clear(void) {
+    log_spin_lock(&log_sites_lock);
+
+    for(size_t i = 0; i < log_site_rule_count; i++)
+        free(log_site_rules[i].pattern);
+
+    free(log_site_rules);
+    log_site_rules = NULL;
+    log_site_rule_count = 0;
+
+    for(struct LogSite* site = log_sites; site; site = site->next)
+        log_site_apply_rules(site);
+
+    log_spin_unlock(&log_sites_lock);
+}
+
+/**
+ * Determines if a target accepts an event. Sites turned on by mist_log_sites_set skip the targets' min_level.
+ */
+static bool log_target_accepts(LogTarget* target, const LogEvent* event) {
+    bool forced = event->site && event->site->force;
+    return (forced || event->level >= target->min_level) && event->level <= target->max_level;
+}
+
+// ======================
+// SECTION: Async Logging
+// ======================
+
+struct LogAsyncRecord {
+    // The target the message was rendered for. NULL for deferred records, which are
+    // formatted for every target by the writer thread.
+    LogTarget* target;
+
+    // The logger a deferred record was logged to, whose targets it is formatted for.
+    Logger* logger;
+
+    // The event that was logged. Its message, format and args are not kept.
+    LogEvent event;
+    String message;
+    struct LogArgs args;
+};
+
+struct LogAsyncSlot {
+    // Vyukov style sequence number. Equal to the slot position when the slot is free,
+    // and one past the position once a producer has published a record into it.
+    volatile size_t sequence;
+    struct LogAsyncRecord record;
+};
+
+struct LogAsyncQueue {
+    struct LogAsyncSlot* slots;
+    size_t mask;
+
+    // Borrowed pointer to the logger that owns the queue.
+    Logger* logger;
+
+    enum LogQueueFullPolicy policy;
+    enum LogLevel drop_below_level;
+    bool deferred;
+
+    // Claimed by producers with a CAS.
+    char enqueue_pad[LOG_CACHE_LINE_SIZE];
+    volatile size_t enqueue_position;
+
+    // Only written by the writer thread.
+    char dequeue_pad[LOG_CACHE_LINE_SIZE];
+    volatile size_t dequeue_position;
+    volatile size_t completed;
+    volatile size_t writer_waiting;
+    volatile size_t running;
+
+    char dropped_pad[LOG_CACHE_LINE_SIZE];
+    volatile size_t dropped;
+
+#ifdef LOG_THREADS
+    LogThread writer;
+    LogMutex mutex;
+    LogCondition wake;
+    LogCondition drained;
+#endif
+};
+
+#ifdef LOG_THREADS
+
+static struct LogAsyncSlot* log_async_queue_claim(struct LogAsyncQueue* queue, size_t* position) {
+    size_t pos = log_atomic_load_size(&queue->enqueue_position);
+    while(true) {
+        struct LogAsyncSlot* slot = queue->slots + (pos & queue->mask);
+        size_t sequence = log_atomic_load_size(&slot->sequence);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+
+        if(difference == 0) {
+            if(log_atomic_cas_size(&queue->enqueue_position, pos, pos + 1)) {
+                *position = pos;
+                return slot;
+            }
+        } else if(difference < 0) {
+            // The writer hasn't released this slot from the previous lap yet, so the queue is full.
+            return NULL;
+        }
+
+        pos = log_atomic_load_size(&queue->enqueue_position);
+    }
+}
+
+static struct LogAsyncSlot* log_async_queue_peek(struct LogAsyncQueue* queue) {
+    size_t pos = queue->dequeue_position;
+    struct LogAsyncSlot* slot = queue->slots + (pos & queue->mask);
+    if(log_atomic_load_size(&slot->sequence) != pos + 1)
+        return NULL;
+
+    return slot;
+}
+
+static void log_async_queue_release(struct LogAsyncQueue* queue, struct LogAsyncSlot* slot) {
+    size_t pos = queue->dequeue_position;
+    log_atomic_store_size(&queue->dequeue_position, pos + 1);
+    log_atomic_store_size(&slot->sequence, pos + queue->mask + 1);
+    log_atomic_add_size(&queue->completed, 1);
+}
+
+static void log_async_wake_writer(struct LogAsyncQueue* queue) {
+    // Pairs with the fence in log_async_writer_run so that either the writer sees the new
+    // record before going to sleep, or this thread sees that the writer is waiting.
+    log_atomic_fence();
+    if(!log_atomic_load_size(&queue->writer_waiting))
+        return;
+
+    log_mutex_lock(&queue->mutex);
+    log_condition_signal(&queue->wake);
+    log_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Claims a slot for a new record, applying the queue's full policy while there isn't one.
+ * Returns NULL if the record was dropped.
+ */
+static struct LogAsyncSlot* log_async_queue_acquire(
+    struct LogAsyncQueue* queue,
+    LogTarget* target,
+    const LogEvent* event,
+    size_t* position)
+{
+    struct LogAsyncSlot* slot;
+
+    while(!(slot = log_async_queue_claim(queue, position))) {
+        if(queue->policy == LOG_QUEUE_DROP || (queue->policy == LOG_QUEUE_DROP_BELOW_LEVEL && event->level < queue->drop_below_level)) {
+            log_atomic_add_size(&queue->dropped, 1);
+            return NULL;
+        }
+
+        log_async_wake_writer(queue);
+        log_thread_yield();
+    }
+
+    slot->record.target = target;
+    slot->record.event = *event;
+    slot->record.event.message = NULL;
+    slot->record.event.format = NULL;
+    slot->record.event.args = NULL;
+
+    return slot;
+}
+
+static void log_async_queue_publish(struct LogAsyncQueue* queue, struct LogAsyncSlot* slot, size_t position) {
+    log_atomic_store_size(&slot->sequence, position + 1);
+    log_async_wake_writer(queue);
+}
+
+static bool log_async_queue_push(
+    struct LogAsyncQueue* queue,
+    LogTarget* target,
+    const LogEvent* event,
+    String* message,
+    bool keep_message)
+{
+    size_t position;
+    struct LogAsyncSlot* slot = log_async_queue_acquire(queue, target, event, &position);
+    if(!slot)
+        return false;
+
+    // A message that is still needed by other targets is copied into the slot's buffer.
+    // The slot is published even if the copy fails so that the queue keeps moving.
+    if(keep_message) {
+        string_clear(&slot->record.message);
+        bool result = string_append_string(&slot->record.message, message);
+        log_async_queue_publish(queue, slot, position);
+        return result;
+    }
+
+    // Otherwise swap the rendered message into the slot instead of copying it. The caller gets back
+    // the (cleared) buffer of the record that previously used the slot.
+    String swap = slot->record.message;
+    slot->record.message = *message;
+    *message = swap;
+
+    log_async_queue_publish(queue, slot, position);
+    return true;
+}
+
+static bool log_async_queue_push_deferred(struct LogAsyncQueue* queue, Logger* logger, const LogEvent* event) {
+    size_t position;
+    struct LogAsyncSlot* slot = log_async_queue_acquire(queue, NULL, event, &position);
+    if(!slot)
+        return false;
+
+    slot->record.logger = logger;
+
+    // The arguments are packed straight into the slot, which stays claimed until it is published.
+    va_list copy;
+    va_copy(copy, *event->args);
+
+    bool result = log_args_pack(&slot->record.args, event->format, copy);
+    va_end(copy);
+
+    if(!result) {
+        // Fall back to formatting the message here if it can't be deferred.
+        String message = string_create("");
+        va_copy(copy, *event->args);
+        result = string_format_args_cstr(&message, event->format, copy) != NULL
+            && log_args_pack_message(&slot->record.args, string_data(&message), string_size(&message));
+        va_end(copy);
+        string_free_resources(&message);
+    }
+
+    // An empty record is still published so the writer can move past the slot.
+    if(!result)
+        slot->record.args.size = 0;
+
+    log_async_queue_publish(queue, slot, position);
+    return result;
+}
+
+static void log_async_write_deferred(struct LogAsyncQueue* queue, struct LogAsyncRecord* record, String* message, String* output) {
+    if(record->args.size == 0)
+        return;
+
+    string_clear(message);
+    if(!log_args_render(&record->args, message))
+        return;
+
+    LogEvent event = record->event;
+    event.message = message;
+
+    // Targets that share a format are next to each other, the same as in log_log_impl.
+    struct LogFormat* rendered = NULL;
+
+    struct LogReader* reader = log_read_begin();
+    struct LogSnapshot* snapshot = log_logger_snapshot(record->logger);
+
+    for(int i = 0; i < snapshot->target_count; i++) {
+        LogTarget* target = snapshot->targets[i];
+        if(!log_target_accepts(target, &event))
+            continue;
+
+        if(target->format != rendered) {
+            string_clear(output);
+            if(!mist_log_format_event(target->format, &event, output)) {
+                rendered = NULL;
+                continue;
+            }
+
+            rendered = target->format;
+        }
+
+        log_target_write(target, &event, output);
+    }
+
+    log_read_end(reader);
+}
+
+static void log_async_writer_run(void* arg) {
+    struct LogAsyncQueue* queue = arg;
+
+    // Scratch buffers used to format deferred records.
+    String message = string_create("");
+    String output = string_create("");
+
+    while(true) {
+        struct LogAsyncSlot* slot = log_async_queue_peek(queue);
+        if(slot) {
+            struct LogAsyncRecord* record = &slot->record;
+            if(record->target) {
+                log_target_write(record->target, &record->event, &record->message);
+                string_clear(&record->message);
+            } else {
+                log_async_write_deferred(queue, record, &message, &output);
+            }
+
+            log_async_queue_release(queue, slot);
+            continue;
+        }
+
+        if(!log_atomic_load_size(&queue->running))
+            break;
+
+        log_mutex_lock(&queue->mutex);
+        log_condition_broadcast(&queue->drained);
+
+        log_atomic_store_size(&queue->writer_waiting, 1);
+        log_atomic_fence();
+        if(!log_async_queue_peek(queue) && log_atomic_load_size(&queue->running))
+            log_condition_wait(&queue->wake, &queue->mutex, 100);
+        log_atomic_store_size(&queue->writer_waiting, 0);
+
+        log_mutex_unlock(&queue->mutex);
+    }
+
+    log_mutex_lock(&queue->mutex);
+    log_condition_broadcast(&queue->drained);
+    log_mutex_unlock(&queue->mutex);
+
+    string_free_resources(&message);
+    string_free_resources(&output);
+}
+
+static void log_async_queue_free(struct LogAsyncQueue* queue) {
+    if(queue->slots) {
+        for(size_t i = 0; i <= queue->mask; i++) {
+            string_free_resources(&queue->slots[i].record.message);
+            log_args_free_resources(&queue->slots[i].record.args);
+        }
+        free(queue->slots);
+    }
+
+    free(queue);
+}
+
+// Blocks until the writer has finished every record before a position in the queue.
+static void log_async_queue_wait(struct LogAsyncQueue* queue, size_t position) {
+    log_mutex_lock(&queue->mutex);
+    while(log_atomic_load_size(&queue->completed) < position) {
+        log_condition_signal(&queue->wake);
+        log_condition_wait(&queue->drained, &queue->mutex, 10);
+    }
+    log_mutex_unlock(&queue->mutex);
+}
+
+static void log_async_queue_stop(struct LogAsyncQueue* queue) {
+    log_atomic_store_size(&queue->running, 0);
+    log_atomic_fence();
+
+    log_mutex_lock(&queue->mutex);
+    log_condition_signal(&queue->wake);
+    log_mutex_unlock(&queue->mutex);
+
+    // The writer drains any remaining records before it exits.
+    log_thread_join(&queue->writer);
+
+    log_condition_destroy(&queue->drained);
+    log_condition_destroy(&queue->wake);
+    log_mutex_destroy(&queue->mutex);
+    log_async_queue_free(queue);
+}
+
+#endif // LOG_THREADS
+
+LOG_EXPORT bool log_logger_enable_async(Logger* logger, size_t capacity, enum LogQueueFullPolicy policy, enum LogLevel drop_below_level) {
+#ifdef LOG_THREADS
+    if(!logger || logger->async || logger->parent)
+        return false;
+
+    size_t slot_count = 2;
+    while(slot_count < capacity)
+        slot_count *= 2;
+
+    struct LogAsyncQueue* queue = calloc(1, sizeof(*queue));
+    if(!queue)
+        return false;
+
+    queue->slots = malloc(sizeof(*queue->slots) * slot_count);
+    if(!queue->slots) {
+        free(queue);
+        return false;
+    }
+
+    for(size_t i = 0; i < slot_count; i++) {
+        queue->slots[i].sequence = i;
+        string_init(&queue->slots[i].record.message, "");
+        memset(&queue->slots[i].record.args, 0, sizeof(queue->slots[i].record.args));
+    }
+
+    queue->mask = slot_count - 1;
+    queue->logger = logger;
+    queue->policy = policy;
+    queue->drop_below_level = drop_below_level;
+    queue->running = 1;
+
+    if(!log_mutex_init(&queue->mutex)) {
+        log_async_queue_free(queue);
+        return false;
+    }
+
+    if(!log_condition_init(&queue->wake)) {
+        log_mutex_destroy(&queue->mutex);
+        log_async_queue_free(queue);
+        return false;
+    }
+
+    if(!log_condition_init(&queue->drained)) {
+        log_condition_destroy(&queue->wake);
+        log_mutex_destroy(&queue->mutex);
+        log_async_queue_free(queue);
+        return false;
+    }
+
+    if(!log_thread_start(&queue->writer, log_async_writer_run, queue)) {
+        log_condition_destroy(&queue->drained);
+        log_condition_destroy(&queue->wake);
+        log_mutex_destroy(&queue->mutex);
+        log_async_queue_free(queue);
+        return false;
+    }
+
+    logger->async = queue;
+    return true;
+#else
+    return false;
+#endif
+}
+
+LOG_EXPORT bool log_logger_set_deferred_formatting(Logger* logger, bool deferred) {
+    if(!logger || !logger->root->async)
+        return false;
+
+    logger->root->async->deferred = deferred;
+    return true;
+}
+
+LOG_EXPORT void log_logger_flush(Logger* logger) {
+    if(!logger)
+        return;
+
+#ifdef LOG_THREADS
+    struct LogAsyncQueue* queue = logger->root->async;
+    if(queue)
+        log_async_queue_wait(queue, log_atomic_load_size(&queue->enqueue_position));
+#endif
+
+    // Everything queued has reached the targets, but they may still hold some of it in their own buffers.
+    struct LogReader* reader = log_read_begin();
+    struct LogSnapshot* snapshot = log_logger_snapshot(logger);
+
+    for(int i = 0; i < snapshot->target_count; i++)
+        log_target_flush(snapshot->targets[i]);
+
+    log_read_end(reader);
+}
+
+LOG_EXPORT size_t log_logger_dropped_count(Logger* logger) {
+#ifdef LOG_THREADS
+    if(!logger || !logger->root->async)
+        return 0;
+
+    return log_atomic_load_size(&logger->root->async->dropped);
+#else
+    return 0;
+#endif
+}
+
+static void log_snapshot_free(struct LogSnapshot* snapshot) {
+    for(int i = 0; i < snapshot->removed_count; i++)
+        log_target_free(snapshot->removed[i]);
+
+    free(snapshot->removed);
+    free(snapshot);
+}
+
+static unsigned int log_target_level_mask(LogTarget* target) {
+    unsigned int mask = 0;
+    for(int level = target->min_level; level <= target->max_level; level++)
+        mask |= 1u << level;
+
+    return mask;
+}
+
+static bool log_targets_contain(LogTarget** targets, int count, LogTarget* target) {
+    for(int i = 0; i < count; i++) {
+        if(targets[i] == target)
+            return true;
+    }
+
+    return false;
+}
+
+static bool log_targets_insert(LogTarget*** targets, int* count, int* capacity, LogTarget* target) {
+    if(*count == *capacity) {
+        int new_capacity = *capacity == 0 ? 2 : *capacity * 2;
+        void* buffer = realloc(*targets, sizeof(**targets) * new_capacity);
+        if(!buffer)
+            return false;
+
+        *targets = buffer;
+        *capacity = new_capacity;
+    }
+
+    // Keep targets that share a format next to each other so that log calls can render it once
+    // for all of them. Otherwise targets keep the order they were added in.
+    int index = *count;
+    for(int i = *count - 1; i >= 0; i--) {
+        if((*targets)[i]->format == target->format) {
+            index = i + 1;
+            break;
+        }
+    }
+
+    memmove(*targets + index + 1, *targets + index, sizeof(**targets) * (*count - index));
+    (*targets)[index] = target;
+    (*count)++;
+
+    return true;
+}
+
+static struct LogSnapshot* log_snapshot_create(Logger* logger, struct LogSnapshot* parent) {
+    int capacity = logger->target_count + (parent ? parent->target_count : 0);
+
+    // The targets are stored right after the snapshot.
+    struct LogSnapshot* snapshot = calloc(1, sizeof(*snapshot) + sizeof(*snapshot->targets) * capacity);
+    if(!snapshot)
+        return NULL;
+
+    snapshot->logger = logger;
+    snapshot->targets = (LogTarget**)(snapshot + 1);
+    snapshot->level = logger->has_level ? logger->level : parent ? parent->level : LOG_TRACE;
+
+    // The array has room for every target, so inserting never needs to resize it.
+    for(int i = 0; i < logger->target_count; i++)
+        log_targets_insert(&snapshot->targets, &snapshot->target_count, &capacity, logger->targets[i]);
+
+    // A target that was also added to the logger itself is only written to once.
+    for(int i = 0; parent && i < parent->target_count; i++) {
+        if(!log_targets_contain(snapshot->targets, snapshot->target_count, parent->targets[i]))
+            log_targets_insert(&snapshot->targets, &snapshot->target_count, &capacity, parent->targets[i]);
+    }
+
+    unsigned int mask = 0;
+    for(int i = 0; i < snapshot->target_count; i++)
+        mask |= log_target_level_mask(snapshot->targets[i]);
+
+    snapshot->level_mask = mask & ~((1u << snapshot->level) - 1);
+    return snapshot;
+}
+
+/**
+ * Builds new snapshots for a logger and all of its children, adding them to a list. Returns false if one couldn't be created.
+ */
+static bool log_snapshots_build(Logger* logger, struct LogSnapshot* parent, struct LogSnapshot** list) {
+    struct LogSnapshot* snapshot = log_snapshot_create(logger, parent);
+    if(!snapshot)
+        return false;
+
+    snapshot->next = *list;
+    *list = snapshot;
+
+    for(Logger* child = logger->first_child; child; child = child->next_sibling) {
+        if(!log_snapshots_build(child, snapshot, list))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Determines if a replaced snapshot can be freed, waiting until it can if wait is true.
+ */
+static bool log_snapshot_reclaimable(struct LogSnapshot* snapshot, bool wait) {
+    if(!snapshot->quiescent) {
+        if(!log_readers_quiescent(snapshot->retired_epoch, wait))
+            return false;
+
+        snapshot->quiescent = true;
+
+#ifdef LOG_THREADS
+        // Messages for the removed targets may still be queued, but every one of them was queued by now.
+        if(snapshot->removed_count > 0 && snapshot->root && snapshot->root->async)
+            snapshot->queue_position = log_atomic_load_size(&snapshot->root->async->enqueue_position);
+#endif
+    }
+
+#ifdef LOG_THREADS
+    struct LogAsyncQueue* queue = snapshot->root ? snapshot->root->async : NULL;
+    if(snapshot->removed_count > 0 && queue && log_atomic_load_size(&queue->completed) < snapshot->queue_position) {
+        if(!wait)
+            return false;
+
+        log_async_queue_wait(queue, snapshot->queue_position);
+    }
+#endif
+
+    return true;
+}
+
+#ifdef LOG_THREADS
+
+// Snapshots that couldn't be freed right away are checked on by the housekeeping thread until they're all gone.
+// The timer can't take log_config_lock itself, because configuration changes hold it while they schedule the timer,
+// so it queues a job that does.
+#define LOG_SNAPSHOTS_RECLAIM_MS 10
+
+static void log_snapshots_reclaim(Logger* root);
+
+static void log_snapshots_job_run(struct LogJob* job);
+static void log_snapshots_timer_fire(struct LogTimer* timer, uint64_t now);
+
+static struct LogTimer log_snapshots_timer = { .fire = log_snapshots_timer_fire };
+static struct LogJob log_snapshots_job = { .run = log_snapshots_job_run };
+static volatile size_t log_snapshots_job_queued = 0;
+
+static void log_snapshots_job_run(struct LogJob* job) {
+    log_atomic_store_size(&log_snapshots_job_queued, 0);
+
+    log_spin_lock(&log_config_lock);
+    log_snapshots_reclaim(NULL);
+    log_spin_unlock(&log_config_lock);
+}
+
+static void log_snapshots_timer_fire(struct LogTimer* timer, uint64_t now) {
+    if(log_atomic_cas_size(&log_snapshots_job_queued, 0, 1))
+        log_job_post(&log_snapshots_job);
+}
+
+#endif
+
+/**
+ * Frees the replaced snapshots that no reader can be using anymore, and leaves the rest to the housekeeping thread.
+ * Must be called while holding log_config_lock.
+ *
+ * @param root The logger whose snapshots are waited for instead of being left for later, or NULL to never wait.
+ *             Ignored while the calling thread is reading a snapshot itself.
+ */
+static void log_snapshots_reclaim(Logger* root) {
+    struct LogReader* self = log_reader_get();
+    if(self && self->depth > 0)
+        root = NULL;
+
+    struct LogSnapshot** link = &log_snapshots_retired;
+    while(*link) {
+        struct LogSnapshot* snapshot = *link;
+        if(!log_snapshot_reclaimable(snapshot, root && snapshot->root == root)) {
+            link = &snapshot->next;
+            continue;
+        }
+
+        *link = snapshot->next;
+        log_snapshot_free(snapshot);
+    }
+
+#ifdef LOG_THREADS
+    if(log_snapshots_retired)
+        log_timer_schedule(&log_snapshots_timer, log_time_now_ns() + LOG_SNAPSHOTS_RECLAIM_MS * 1000000ULL);
+#endif
+}
+
+/**
+ * Replaces the snapshots of a logger and all of its children after its configuration has changed.
+ * Must be called while holding log_config_lock.
+ *
+ * @param removed Targets that were removed from the logger. Freed once no log call can be using them anymore.
+ *                The array is owned by the logger afterwards, unless the update fails.
+ */
+static bool log_logger_update(Logger* logger, LogTarget** removed, int removed_count) {
+    struct LogSnapshot* list = NULL;
+    if(!log_snapshots_build(logger, logger->parent ? logger->parent->snapshot : NULL, &list)) {
+        while(list) {
+            struct LogSnapshot* next = list->next;
+            free(list);
+            list = next;
+        }
+
+        return false;
+    }
+
+    struct LogSnapshot* retired = NULL;
+    while(list) {
+        struct LogSnapshot* snapshot = list;
+        list = snapshot->next;
+
+        Logger* owner = snapshot->logger;
+        struct LogSnapshot* previous = owner->snapshot;
+
+        log_atomic_store_ptr((void* volatile*)&owner->snapshot, snapshot);
+        owner->effective_level = snapshot->level;
+        owner->level_mask = snapshot->level_mask;
+
+        if(previous) {
+            previous->next = retired;
+            retired = previous;
+        }
+    }
+
+    if(retired) {
+        retired->removed = removed;
+        retired->removed_count = removed_count;
+    } else {
+        for(int i = 0; i < removed_count; i++)
+            log_target_free(removed[i]);
+
+        free(removed);
+    }
+
+    // Readers that start after the new epoch can only see the new snapshots.
+    size_t epoch = log_atomic_add_size(&log_epoch, 1);
+    while(retired) {
+        struct LogSnapshot* snapshot = retired;
+        retired = snapshot->next;
+
+        snapshot->retired_epoch = epoch;
+        snapshot->root = logger->root;
+        snapshot->next = log_snapshots_retired;
+        log_snapshots_retired = snapshot;
+    }
+
+    log_snapshots_reclaim(NULL);
+    return true;
+}
+
+LOG_EXPORT Logger* log_logger_create() {
+    Logger* logger = calloc(1, sizeof(*logger));
+    if(!logger)
+        return NULL;
+
+    logger->root = logger;
+    logger->snapshot = log_snapshot_create(logger, NULL);
+    if(!logger->snapshot) {
+        free(logger);
+        return NULL;
+    }
+
+    return logger;
+}
+
+/**
+ * Determines if a target was added to any logger of a tree other than the given one.
+ */
+static bool log_tree_has_target(Logger* tree, Logger* except, LogTarget* target) {
+    if(tree != except && log_targets_contain(tree->targets, tree->target_count, target))
+        return true;
+
+    for(Logger* child = tree->first_child; child; child = child->next_sibling) {
+        if(log_tree_has_target(child, except, target))
+            return true;
+    }
+
+    return false;
+}
+
+static void log_config_applied_free(struct LogConfigApplied* applied);
+static void log_config_applied_forget(struct LogConfigApplied* applied, Logger* tree);
+
+// Frees a logger after its children. A target is only freed by the last logger that has it, so the tree being freed
+// and the rest of the tree it was removed from (if any) are both checked for other loggers that still do.
+static void log_logger_free_tree(Logger* logger, Logger* top) {
+    while(logger->first_child) {
+        Logger* child = logger->first_child;
+        logger->first_child = child->next_sibling;
+        log_logger_free_tree(child, top);
+    }
+
+    for(int i = 0; i < logger->target_count; i++) {
+        LogTarget* target = logger->targets[i];
+        if(!log_tree_has_target(top, logger, target) && !log_tree_has_target(logger->root, logger, target))
+            log_target_free(target);
+    }
+
+    log_config_applied_free(logger->config);
+    free(logger->targets);
+    free(logger->snapshot);
+    free(logger->name);
+    free(logger);
+}
+
+static void log_logger_free_locked(Logger* logger) {
+    // A child that is freed on its own is removed from its parent first, once none of its
+    // deferred messages are left in the queue.
+    if(logger->parent) {
+        log_logger_flush(logger);
+
+        Logger** link = &logger->parent->first_child;
+        while(*link != logger)
+            link = &(*link)->next_sibling;
+
+        *link = logger->next_sibling;
+
+        // Configurations loaded into its parents must not replace the targets of a freed child later on.
+        for(Logger* parent = logger->parent; parent; parent = parent->parent) {
+            if(parent->config)
+                log_config_applied_forget(parent->config, logger);
+        }
+    }
+
+    log_logger_free_tree(logger, logger);
+}
+
+LOG_EXPORT void log_logger_free(Logger* logger) {
+    log_spin_lock(&log_config_lock);
+
+    // Replaced snapshots may still refer to the logger's queue.
+    log_snapshots_reclaim(logger->root);
+
+#ifdef LOG_THREADS
+    // Stop the writer thread first so that every queued message reaches its target.
+    if(logger->async)
+        log_async_queue_stop(logger->async);
+#endif
+
+    // Snapshots that couldn't be reclaimed above (i.e. when freeing from inside a log call) are left for the
+    // housekeeping thread, which mustn't look at the freed tree. Nothing is left in its queue by now.
+    if(!logger->parent) {
+        for(struct LogSnapshot* snapshot = log_snapshots_retired; snapshot; snapshot = snapshot->next) {
+            if(snapshot->root == logger)
+                snapshot->root = NULL;
+        }
+    }
+
+    log_logger_free_locked(logger);
+
+    log_spin_unlock(&log_config_lock);
+}
+
+// Marks targets whose members after max_level were set by log_target_init.
+#define LOG_TARGET_INITIALIZED 0x4C544754U
+
+LOG_EXPORT void log_target_init(LogTarget* target, struct LogFormat* format, enum LogLevel min_level, enum LogLevel max_level) {
+    memset(target, 0, sizeof(*target));
+    target->format = format;
+    target->min_level = min_level;
+    target->max_level = max_level;
+    target->initialized = LOG_TARGET_INITIALIZED;
+}
+
+// Targets set up by assigning only the members that the first versions of LogTarget had leave the rest
+// uninitialized, which would otherwise be read as callbacks and locks.
+static void log_target_normalize(LogTarget* target) {
+    if(target->initialized == LOG_TARGET_INITIALIZED)
+        return;
+
+    size_t start = offsetof(LogTarget, max_level) + sizeof(target->max_level);
+    memset((char*)target + start, 0, sizeof(*target) - start);
+    target->initialized = LOG_TARGET_INITIALIZED;
+}
+
+LOG_EXPORT void log_target_flush(LogTarget* target) {
+    if(target && target->flush)
+        target->flush(target->ctx);
+}
+
+LOG_EXPORT void log_target_free(LogTarget* target) {
+    if(!target)
+        return;
+
+    log_format_release(target->format);
+
+    if(target->free)
+        target->free(target->ctx);
+
+    free(target);
+}
+
+static Logger* log_logger_get_child_locked(Logger* logger, const char* name) {
+    while(*name) {
+        size_t length = strcspn(name, ".");
+        if(length != 0) {
+            Logger* child = logger->first_child;
+            while(child && (strncmp(child->name, name, length) != 0 || child->name[length] != '\0'))
+                child = child->next_sibling;
+
+            if(!child) {
+                child = calloc(1, sizeof(*child));
+                if(!child)
+                    return NULL;
+
+                child->name = malloc(length + 1);
+                if(!child->name) {
+                    free(child);
+                    return NULL;
+                }
+
+                memcpy(child->name, name, length);
+                child->name[length] = '\0';
+                child->parent = logger;
+                child->root = logger->root;
+                child->next_sibling = logger->first_child;
+                logger->first_child = child;
+
+                if(!log_logger_update(child, NULL, 0)) {
+                    log_logger_free_locked(child);
+                    return NULL;
+                }
+            }
+
+            logger = child;
+        }
+
+        name += length;
+        if(*name == '.')
+            name++;
+    }
+
+    return logger;
+}
+
+LOG_EXPORT Logger* log_logger_get_child(Logger* logger, const char* name) {
+    if(!logger || !name)
+        return NULL;
+
+    log_spin_lock(&log_config_lock);
+    Logger* child = log_logger_get_child_locked(logger, name);
+    log_spin_unlock(&log_config_lock);
+
+    return child;
+}
+
+LOG_EXPORT void log_logger_set_level(Logger* logger, enum LogLevel level) {
+    if(!logger)
+        return;
+
+    log_spin_lock(&log_config_lock);
+
+    logger->level = level;
+    logger->has_level = true;
+    log_logger_update(logger, NULL, 0);
+
+    log_spin_unlock(&log_config_lock);
+}
+
+LOG_EXPORT void log_logger_inherit_level(Logger* logger) {
+    if(!logger)
+        return;
+
+    log_spin_lock(&log_config_lock);
+
+    logger->has_level = false;
+    log_logger_update(logger, NULL, 0);
+
+    log_spin_unlock(&log_config_lock);
+}
+
+LOG_EXPORT void log_logger_refresh_levels(Logger* logger) {
+    if(!logger)
+        return;
+
+    log_spin_lock(&log_config_lock);
+    log_logger_update(logger, NULL, 0);
+    log_spin_unlock(&log_config_lock);
+}
+
+static bool log_add_target_locked(Logger* logger, LogTarget* target) {
+    if(!log_targets_insert(&logger->targets, &logger->target_count, &logger->target_capacity, target))
+        return false;
+
+    if(!log_logger_update(logger, NULL, 0)) {
+        // Undo the insert so the target isn't freed along with the logger.
+        for(int i = 0; i < logger->target_count; i++) {
+            if(logger->targets[i] == target) {
+                memmove(logger->targets + i, logger->targets + i + 1, sizeof(*logger->targets) * (logger->target_count - i - 1));
+                logger->target_count--;
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+LOG_EXPORT bool log_add_target(Logger* logger, LogTarget* target) {
+    if(!logger)
+        return false;
+
+    log_spin_lock(&log_config_lock);
+    if(target)
+        log_target_normalize(target);
+
+    bool result = log_add_target_locked(logger, target);
+    log_spin_unlock(&log_config_lock);
+
+    return result;
+}
+
+LOG_EXPORT bool log_remove_target(Logger* logger, LogTarget* target) {
+    if(!logger || !target)
+        return false;
+
+    LogTarget** removed = malloc(sizeof(*removed));
+    if(!removed)
+        return false;
+
+    removed[0] = target;
+
+    log_spin_lock(&log_config_lock);
+
+    int index = 0;
+    while(index < logger->target_count && logger->targets[index] != target)
+        index++;
+
+    bool result = index < logger->target_count;
+    if(result) {
+        memmove(logger->targets + index, logger->targets + index + 1, sizeof(*logger->targets) * (logger->target_count - index - 1));
+        logger->target_count--;
+
+        // A target that other loggers of the tree still have stays with them.
+        int removed_count = log_tree_has_target(logger->root, NULL, target) ? 0 : 1;
+        result = log_logger_update(logger, removed, removed_count);
+        if(!result) {
+            memmove(logger->targets + index + 1, logger->targets + index, sizeof(*logger->targets) * (logger->target_count - index));
+            logger->targets[index] = target;
+            logger->target_count++;
+        }
+    }
+
+    log_spin_unlock(&log_config_lock);
+
+    if(!result)
+        free(removed);
+
+    return result;
+}
+
+LOG_EXPORT void log_set_lock(Logger* logger, void* mutex, void (*lock)(void* mtx, bool lock)) {
+    if(!logger)
+        return;
+
+    // Log calls only look at the lock of the root.
+    logger = logger->root;
+    logger->mutex = mutex;
+    logger->lock = lock;
+}
+
+LOG_EXPORT void log_target_set_lock(LogTarget* target, void* mutex, void (*lock)(void* mtx, bool lock)) {
+    if(!target)
+        return;
+
+    target->mutex = mutex;
+    target->lock = lock;
+}
+
+/**
+ * Sends an event to the targets of a logger. The event's format and arguments are only read through copies.
+ */
+static bool log_dispatch(Logger* logger, LogEvent* event) {
+    // Children share the lock and queue of the logger at the top of their tree.
+    Logger* root = logger->root;
+
+#ifdef LOG_THREADS
+    // Deferred records only hold copies of the arguments, so they don't need the user's lock.
+    if(root->async && root->async->deferred)
+        return log_async_queue_push_deferred(root->async, logger, event);
+#endif
+
+    // The targets are read from the logger's current snapshot, which stays valid until the read section ends
+    // even if the configuration is changed in the meantime.
+    struct LogReader* reader = log_read_begin();
+    struct LogSnapshot* snapshot = log_logger_snapshot(logger);
+
+    // Render into this thread's reusable buffers. A nested log call (e.g. from inside a target)
+    // falls back to temporary strings instead.
+    String nested_output;
+    String nested_message;
+    struct LogThreadBuffers* buffers = log_thread_buffers_acquire();
+    String* output = &nested_output;
+    String* user_message = &nested_message;
+    if(buffers) {
+        output = &buffers->output;
+        user_message = &buffers->message;
+    } else {
+        string_init(&nested_output, "");
+        string_init(&nested_message, "");
+    }
+
+    bool result = true;
+
+    // Targets with the same layout share a LogFormat and are kept next to each other,
+    // so the message is only rendered again when the format changes.
+    struct LogFormat* rendered = NULL;
+
+    // Messages are rendered into this thread's buffers without holding any lock. Only writing the rendered
+    // message takes the target's lock, unless rendering the format changes state that the lock protects.
+    for(int i = 0; i < snapshot->target_count; i++) {
+        LogTarget* target = snapshot->targets[i];
+        if(!log_target_accepts(target, event))
+            continue;
+
+        bool stateful = target->format->stateful;
+        if(stateful)
+            log_target_lock(root, target, true);
+
+        if(target->format != rendered || stateful) {
+            // The user's message is formatted at most once per event, the first time a layout needs it.
+            bool rendered_message = event->message || !target->format->uses_message || log_event_render_message(event, user_message);
+
+            string_clear(output);
+            if(!rendered_message || !mist_log_format_event(target->format, event, output)) {
+                if(stateful)
+                    log_target_lock(root, target, false);
+
+                result = false;
+                break;
+            }
+
+            rendered = stateful ? NULL : target->format;
+        }
+
+#ifdef LOG_THREADS
+        // Only the writer thread writes to the targets of an asynchronous logger, so pushing doesn't need the lock.
+        if(root->async) {
+            bool shared = rendered && i + 1 < snapshot->target_count && snapshot->targets[i + 1]->format == rendered;
+            log_async_queue_push(root->async, target, event, output, shared);
+
+            if(stateful)
+                log_target_lock(root, target, false);
+
+            // An unshared message was swapped into the queue.
+            if(!shared)
+                rendered = NULL;
+            continue;
+        }
+#endif
+
+        if(!stateful)
+            log_target_lock(root, target, true);
+
+        log_target_write(target, event, output);
+        log_target_lock(root, target, false);
+    }
+
+    if(buffers) {
+        log_thread_buffers_release(buffers);
+    } else {
+        string_free_resources(&nested_output);
+        string_free_resources(&nested_message);
+    }
+
+    log_read_end(reader);
+
+    return result;
+}
+
+static bool log_log_impl(Logger* logger, struct LogSite* site, enum LogLevel log_level, const char* file, const char* function, int line, const char* message, va_list args) {
+    if(!logger)
+        return false;
+
+    // No target accepts the level, so there's no need to lock or format anything. Sites that
+    // were turned on or off with mist_log_sites_set decide for themselves.
+    if(site ? !mist_log_site_enabled(logger, *site) : !mist_log_level_enabled(logger, log_level))
+        return true;
+
+    // Every target sees the same event, and the arguments are copied so that they can be read once per use.
+    va_list copy;
+    va_copy(copy, args);
+
+    LogEvent event;
+    log_event_init(&event, log_level, file, function, line, message, &copy);
+    event.site = site;
+
+    bool result = log_dispatch(logger, &event);
+
+    va_end(copy);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_string(Logger* logger, enum LogLevel log_level, const char* file, int line, const String* message, ...) {
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, NULL, log_level, file, "", line, string_data(message), args);
+
+    va_end(args);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_func_string(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const String* message, ...) {
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, NULL, log_level, file, function, line, string_data(message), args);
+
+    va_end(args);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_cstr(Logger* logger, enum LogLevel log_level, const char* file, int line, const char* message, ...) {
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, NULL, log_level, file, "", line, message, args);
+
+    va_end(args);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_func_cstr(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const char* message, ...) {
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, NULL, log_level, file, function, line, message, args);
+
+    va_end(args);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_site(Logger* logger, struct LogSite* site, const char* message, ...) {
+    if(!site->registered)
+        log_site_register(site);
+
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, site, site->level, site->file, site->function, site->line, message, args);
+
+    va_end(args);
+
+    return result;
+}
+
+LOG_EXPORT bool mist_log_site_string(Logger* logger, struct LogSite* site, const String* message, ...) {
+    if(!site->registered)
+        log_site_register(site);
+
+    va_list args;
+    va_start(args, message);
+
+    bool result = log_log_impl(logger, site, site->level, site->file, site->function, site->line, string_data(message), args);
+
+    va_end(args);
+
+    return result;
+}
+
+// =====================
+// SECTION: Housekeeping
+// =====================
+
+// Work that doesn't have to happen while a message is logged is done by a single housekeeping thread, which is
+// started when it's first needed: timers that fire at a given time, and jobs that are run as soon as possible.
+//
+// Timers are kept in a hierarchical timing wheel. Each level has LOG_TIMER_SLOTS slots, and each slot of a level covers
+// as many ticks as the whole level below it. A timer is put in the lowest level that reaches its expiry, and
+// moved down a level whenever the wheel turns into its slot, so scheduling, cancelling and firing a timer
+// take constant time no matter how many timers there are.
+//
+// The wheel turns with a monotonic clock, so setting the wall clock doesn't make it catch up on (or wait for) the
+// ticks in between. Timers are still scheduled for a wall clock time, and one that comes due before that time
+// because the wall clock was set back is scheduled again for the rest of it.
+
+// The resolution of the wheel in milliseconds.
+#define LOG_TIMER_TICK_MS 10
+#define LOG_TIMER_TICK_NS (LOG_TIMER_TICK_MS * 1000000ULL)
+
+#define LOG_TIMER_BITS 6
+#define LOG_TIMER_SLOTS (1 << LOG_TIMER_BITS)
+#define LOG_TIMER_MASK (LOG_TIMER_SLOTS - 1)
+
+// Enough levels to cover about 20 years. Timers further out wait in the last slot and are moved again later.
+#define LOG_TIMER_LEVELS 6
+
+#ifdef LOG_THREADS
+
+struct LogTimerWheel {
+    LogMutex mutex;
+    LogCondition condition;
+    LogThread thread;
+
+    // Signaled whenever the housekeeping thread finishes a job.
+    LogCondition jobs_done;
+
+    // The queued jobs, oldest first, and the number of jobs that haven't finished yet.
+    struct LogJob* jobs_first;
+    struct LogJob* jobs_last;
+    size_t jobs_pending;
+
+    // The last tick that has been processed.
+    uint64_t current;
+
+    // The tick the housekeeping thread wakes up at if no earlier timer is scheduled.
+    uint64_t wake;
+
+    size_t count;
+    bool running;
+
+    struct LogTimer* slots[LOG_TIMER_LEVELS][LOG_TIMER_SLOTS];
+};
+
+static struct LogTimerWheel* log_timer_wheel = NULL;
+static volatile size_t log_timer_wheel_lock = 0;
+
+// Set on the housekeeping thread while it runs a callback, which already holds the lock of the wheel.
+static LOG_THREAD_LOCAL bool log_timer_firing = false;
+
+static void log_timer_link(struct LogTimer** list, struct LogTimer* timer) {
+    timer->list = list;
+    timer->prev = NULL;
+    timer->next = *list;
+    if(*list)
+        (*list)->prev = timer;
+
+    *list = timer;
+}
+
+static void log_timer_unlink(struct LogTimer* timer) {
+    if(timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *timer->list = timer->next;
+
+    if(timer->next)
+        timer->next->prev = timer->prev;
+
+    timer->list = NULL;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+// Puts a timer in the slot that covers its expiry. Timers that expired before the earliest tick
+// are put in the slot of that tick.
+static void log_timer_wheel_add(struct LogTimerWheel* wheel, struct LogTimer* timer, uint64_t earliest) {
+    uint64_t expires = timer->expires < earliest ? earliest : timer->expires;
+    uint64_t delta = expires - wheel->current;
+
+    int level = 0;
+    while(level < LOG_TIMER_LEVELS - 1 && delta >= 1ULL << (LOG_TIMER_BITS * (level + 1)))
+        level++;
+
+    uint64_t range = 1ULL << (LOG_TIMER_BITS * LOG_TIMER_LEVELS);
+    if(delta >= range)
+        expires = wheel->current + range - 1;
+
+    size_t slot = (expires >> (LOG_TIMER_BITS * level)) & LOG_TIMER_MASK;
+    log_timer_link(&wheel->slots[level][slot], timer);
+}
+
+// Moves the timers of a slot of a higher level into the levels below it.
+static void log_timer_wheel_cascade(struct LogTimerWheel* wheel, int level, size_t slot) {
+    struct LogTimer* timers = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+
+    while(timers) {
+        struct LogTimer* timer = timers;
+        timers = timer->next;
+        log_timer_wheel_add(wheel, timer, wheel->current);
+    }
+}
+
+// Moves the wheel forward by one tick and runs the timers that expire at it.
+static void log_timer_wheel_advance(struct LogTimerWheel* wheel, uint64_t now) {
+    wheel->current++;
+
+    size_t slot = wheel->current & LOG_TIMER_MASK;
+    for(int level = 1; slot == 0 && level < LOG_TIMER_LEVELS; level++) {
+        slot = (wheel->current >> (LOG_TIMER_BITS * level)) & LOG_TIMER_MASK;
+        log_timer_wheel_cascade(wheel, level, slot);
+    }
+
+    // The expired timers are taken out of the wheel first, so that callbacks are free to
+    // schedule or cancel any timer, including the ones that haven't been run yet.
+    struct LogTimer* expired = NULL;
+    struct LogTimer** list = &wheel->slots[0][wheel->current & LOG_TIMER_MASK];
+    while(*list) {
+        struct LogTimer* timer = *list;
+        log_timer_unlink(timer);
+        log_timer_link(&expired, timer);
+    }
+
+    while(expired) {
+        struct LogTimer* timer = expired;
+        log_timer_unlink(timer);
+
+        // Timers beyond the range of the wheel are only moved closer.
+        if(timer->expires > wheel->current) {
+            log_timer_wheel_add(wheel, timer, wheel->current + 1);
+            continue;
+        }
+
+        if(now < timer->deadline) {
+            timer->expires = wheel->current + (timer->deadline - now + LOG_TIMER_TICK_NS - 1) / LOG_TIMER_TICK_NS;
+            log_timer_wheel_add(wheel, timer, wheel->current + 1);
+            continue;
+        }
+
+        wheel->count--;
+
+        log_timer_firing = true;
+        timer->fire(timer, now);
+        log_timer_firing = false;
+    }
+}
+
+// Finds the next tick the housekeeping thread has to wake up at, either to run timers or to move them down a level.
+// Every tick before it only passes empty slots.
+static uint64_t log_timer_wheel_next(struct LogTimerWheel* wheel) {
+    uint64_t next = UINT64_MAX;
+    if(wheel->count == 0)
+        return next;
+
+    // A higher level can reach a slot before a lower one does, when its timers are about to be moved down.
+    for(int level = 0; level < LOG_TIMER_LEVELS; level++) {
+        int shift = LOG_TIMER_BITS * level;
+        uint64_t base = wheel->current >> shift;
+
+        for(uint64_t distance = 1; distance <= LOG_TIMER_SLOTS; distance++) {
+            if(wheel->slots[level][(base + distance) & LOG_TIMER_MASK]) {
+                uint64_t tick = (base + distance) << shift;
+                if(tick < next)
+                    next = tick;
+
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+static void log_timer_wheel_run(void* arg) {
+    struct LogTimerWheel* wheel = arg;
+
+    log_mutex_lock(&wheel->mutex);
+    while(wheel->running) {
+        uint64_t now = log_time_now_ns();
+        uint64_t tick = log_time_monotonic_ns() / LOG_TIMER_TICK_NS;
+
+        // The wheel jumps over the empty slots instead of turning through every tick, which only matters
+        // after the thread was held up for a while, e.g. while the system was suspended.
+        while(wheel->current < tick) {
+            uint64_t next = log_timer_wheel_next(wheel);
+            if(next > tick) {
+                wheel->current = tick;
+                break;
+            }
+
+            wheel->current = next - 1;
+            log_timer_wheel_advance(wheel, now);
+        }
+
+        // Jobs are run without holding the lock, so that they don't hold up threads scheduling timers.
+        if(wheel->jobs_first) {
+            struct LogJob* job = wheel->jobs_first;
+            wheel->jobs_first = job->next;
+            if(!wheel->jobs_first)
+                wheel->jobs_last = NULL;
+
+            log_mutex_unlock(&wheel->mutex);
+            job->run(job);
+            log_mutex_lock(&wheel->mutex);
+
+            wheel->jobs_pending--;
+            log_condition_broadcast(&wheel->jobs_done);
+            continue;
+        }
+
+        wheel->wake = log_timer_wheel_next(wheel);
+
+        uint64_t wait = UINT32_MAX;
+        if(wheel->wake != UINT64_MAX)
+            wait = (wheel->wake - tick) * LOG_TIMER_TICK_MS;
+
+        log_condition_wait(&wheel->condition, &wheel->mutex, wait >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)wait);
+    }
+    log_mutex_unlock(&wheel->mutex);
+}
+
+static struct LogTimerWheel* log_timer_wheel_get(void) {
+    struct LogTimerWheel* wheel = log_atomic_load_ptr((void* volatile*)&log_timer_wheel);
+    if(wheel)
+        return wheel;
+
+    log_spin_lock(&log_timer_wheel_lock);
+
+    wheel = log_timer_wheel;
+    if(!wheel) {
+        wheel = calloc(1, sizeof(*wheel));
+        if(wheel) {
+            wheel->current = log_time_monotonic_ns() / LOG_TIMER_TICK_NS;
+            wheel->wake = UINT64_MAX;
+
+            if(!log_mutex_init(&wheel->mutex)) {
+                free(wheel);
+                wheel = NULL;
+            } else if(!log_condition_init(&wheel->condition)) {
+                log_mutex_destroy(&wheel->mutex);
+                free(wheel);
+                wheel = NULL;
+            } else if(!log_condition_init(&wheel->jobs_done)) {
+                log_condition_destroy(&wheel->condition);
+                log_mutex_destroy(&wheel->mutex);
+                free(wheel);
+                wheel = NULL;
+            } else {
+                // The housekeeping thread runs until log_shutdown is called.
+                wheel->running = true;
+                if(!log_thread_start(&wheel->thread, log_timer_wheel_run, wheel)) {
+                    log_condition_destroy(&wheel->jobs_done);
+                    log_condition_destroy(&wheel->condition);
+                    log_mutex_destroy(&wheel->mutex);
+                    free(wheel);
+                    wheel = NULL;
+                } else {
+                    log_atomic_store_ptr((void* volatile*)&log_timer_wheel, wheel);
+                }
+            }
+        }
+    }
+
+    log_spin_unlock(&log_timer_wheel_lock);
+    return wheel;
+}
+
+/**
+ * Schedules a timer to fire at the given time (in nanoseconds since the epoch), moving it if it is already scheduled.
+ */
+static bool log_timer_schedule(struct LogTimer* timer, uint64_t when) {
+    struct LogTimerWheel* wheel = log_timer_wheel_get();
+    if(!wheel)
+        return false;
+
+    // Callbacks already hold the lock.
+    bool locked = log_timer_firing;
+    if(!locked)
+        log_mutex_lock(&wheel->mutex);
+
+    if(timer->list)
+        log_timer_unlink(timer);
+    else
+        wheel->count++;
+
+    uint64_t wall = log_time_now_ns();
+    uint64_t delay = when > wall ? when - wall : 0;
+
+    // Round up, so that timers never fire early.
+    timer->deadline = when;
+    timer->expires = (log_time_monotonic_ns() + delay + LOG_TIMER_TICK_NS - 1) / LOG_TIMER_TICK_NS;
+    log_timer_wheel_add(wheel, timer, wheel->current + 1);
+
+    if(timer->expires < wheel->wake) {
+        wheel->wake = timer->expires;
+        log_condition_signal(&wheel->condition);
+    }
+
+    if(!locked)
+        log_mutex_unlock(&wheel->mutex);
+
+    return true;
+}
+
+/**
+ * Removes a timer from the wheel. Once this returns, its callback isn't running and won't run anymore.
+ */
+static void log_timer_cancel(struct LogTimer* timer) {
+    struct LogTimerWheel* wheel = log_atomic_load_ptr((void* volatile*)&log_timer_wheel);
+    if(!wheel)
+        return;
+
+    bool locked = log_timer_firing;
+    if(!locked)
+        log_mutex_lock(&wheel->mutex);
+
+    if(timer->list) {
+        log_timer_unlink(timer);
+        wheel->count--;
+    }
+
+    if(!locked)
+        log_mutex_unlock(&wheel->mutex);
+}
+
+/**
+ * Queues a job for the housekeeping thread. The job is run right away if the thread can't be started.
+ */
+static void log_job_post(struct LogJob* job) {
+    struct LogTimerWheel* wheel = log_timer_wheel_get();
+    if(!wheel) {
+        job->run(job);
+        return;
+    }
+
+    bool locked = log_timer_firing;
+    if(!locked)
+        log_mutex_lock(&wheel->mutex);
+
+    job->next = NULL;
+    if(wheel->jobs_last)
+        wheel->jobs_last->next = job;
+    else
+        wheel->jobs_first = job;
+
+    wheel->jobs_last = job;
+    wheel->jobs_pending++;
+    log_condition_signal(&wheel->condition);
+
+    if(!locked)
+        log_mutex_unlock(&wheel->mutex);
+}
+
+/**
+ * Waits until every job queued so far has finished. Must not be called from the housekeeping thread.
+ */
+static void log_jobs_wait(void) {
+    struct LogTimerWheel* wheel = log_atomic_load_ptr((void* volatile*)&log_timer_wheel);
+    if(!wheel)
+        return;
+
+    log_mutex_lock(&wheel->mutex);
+    while(wheel->jobs_pending > 0)
+        log_condition_wait(&wheel->jobs_done, &wheel->mutex, 100);
+    log_mutex_unlock(&wheel->mutex);
+}
+
+LOG_EXPORT void log_shutdown(void) {
+    // The global stays set until the thread has stopped, so that jobs it's still running can use the wheel.
+    struct LogTimerWheel* wheel = log_atomic_load_ptr((void* volatile*)&log_timer_wheel);
+    if(!wheel)
+        return;
+
+    log_mutex_lock(&wheel->mutex);
+    wheel->running = false;
+    log_condition_signal(&wheel->condition);
+    log_mutex_unlock(&wheel->mutex);
+
+    log_thread_join(&wheel->thread);
+
+    log_spin_lock(&log_timer_wheel_lock);
+    log_atomic_store_ptr((void* volatile*)&log_timer_wheel, NULL);
+    log_spin_unlock(&log_timer_wheel_lock);
+
+    // Jobs that didn't get their turn are finished here, since some of them own the memory they use.
+    while(wheel->jobs_first) {
+        struct LogJob* job = wheel->jobs_first;
+        wheel->jobs_first = job->next;
+        job->run(job);
+    }
+
+    // Timers that are still scheduled belong to targets that weren't freed first, which stop flushing and
+    // archiving in the background.
+    for(int level = 0; level < LOG_TIMER_LEVELS; level++) {
+        for(size_t slot = 0; slot < LOG_TIMER_SLOTS; slot++) {
+            while(wheel->slots[level][slot])
+                log_timer_unlink(wheel->slots[level][slot]);
+        }
+    }
+
+    log_condition_destroy(&wheel->jobs_done);
+    log_condition_destroy(&wheel->condition);
+    log_mutex_destroy(&wheel->mutex);
+    free(wheel);
+}
+
+#else // LOG_THREADS
+
+// Without threads nothing runs timers, so work that would be done by them waits until the next message,
+// and jobs are run as soon as they're posted.
+
+static bool log_timer_schedule(struct LogTimer* timer, uint64_t when) {
+    return false;
+}
+
+static void log_timer_cancel(struct LogTimer* timer) {
+}
+
+static void log_job_post(struct LogJob* job) {
+    job->run(job);
+}
+
+static void log_jobs_wait(void) {
+}
+
+LOG_EXPORT void log_shutdown(void) {
+}
+
+#endif // LOG_THREADS
+
+// ====================
+// SECTION: Log Targets
+// ====================
+
+static void log_console_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ctx) {
+    puts(string_data(msg));
+}
+
+static void log_console_flush(void* ctx) {
+    fflush(stdout);
+}
+
+LogTarget* log_target_console_create(const char* layout, enum LogLevel min_level, enum LogLevel max_level) {
+    LogTarget* target = malloc(sizeof(*target));
+    if(!target)
+        return NULL;
+
+    struct LogFormat* fmt = log_format_intern(layout);
+    if(!fmt) {
+        free(target);
+        return NULL;
+    }
+
+    log_target_init(target, fmt, min_level, max_level);
+    target->log = log_console_log;
+    target->flush = log_console_flush;
+
+    return target;
+}
+
+// Finds the shortest time unit a strftime format prints, so that names using it are only rendered
+// again once that unit changes.
+static enum LogFileNameUnit log_file_name_format_unit(const char* format) {
+    enum LogFileNameUnit unit = LOG_FILE_NAME_DAY;
+    for(const char* c = format; *c; c++) {
+        if(*c != '%')
+            continue;
+
+        c++;
+        while(*c == 'E' || *c == 'O')
+            c++;
+
+        switch(*c) {
+            case '\0':
+                return unit;
+            case '%':
+            case 'n':
+            case 't':
+            // Dates.
+            case 'a': case 'A': case 'b': case 'B': case 'h': case 'C': case 'd': case 'e': case 'D': case 'F':
+            case 'g': case 'G': case 'j': case 'm': case 'u': case 'U': case 'V': case 'w': case 'W': case 'x':
+            case 'y': case 'Y':
+                break;
+            case 'M':
+            case 'R':
+                if(unit > LOG_FILE_NAME_MINUTE)
+                    unit = LOG_FILE_NAME_MINUTE;
+                break;
+            // The time zone only changes at the start of an hour.
+            case 'H': case 'I': case 'k': case 'l': case 'p': case 'P': case 'z': case 'Z':
+                if(unit > LOG_FILE_NAME_HOUR)
+                    unit = LOG_FILE_NAME_HOUR;
+                break;
+            default:
+                return LOG_FILE_NAME_SECOND;
+        }
+    }
+
+    return unit;
+}
+
+static void log_file_name_classify(struct LogFileTargetContext* ctx) {
+    enum LogFileNameKind kind = LOG_FILE_NAME_CONSTANT;
+    enum LogFileNameUnit unit = LOG_FILE_NAME_DAY;
+    bool has_utc = false;
+    bool has_local = false;
+
+    for(int i = 0; i < ctx->file_name->step_count; i++) {
+        struct LogLayoutRenderer* renderer = ctx->file_name->steps[i];
+        enum LogFileNameUnit step_unit;
+        bool is_utc;
+
+        switch(log_format_op_code(renderer)) {
+            case LOG_OP_TEXT:
+                continue;
+            case LOG_OP_LEVEL:
+                if(kind == LOG_FILE_NAME_CONSTANT)
+                    kind = LOG_FILE_NAME_LEVEL;
+                continue;
+            case LOG_OP_TIME: {
+                struct LogFormatTime* time_format = renderer->ctx;
+                step_unit = log_file_name_format_unit(string_data(&time_format->format));
+                is_utc = time_format->is_utc;
+                break;
+            }
+            case LOG_OP_TIMESTAMP: {
+                struct LogFormatTimestamp* timestamp = renderer->ctx;
+                if(timestamp->precision > 0) {
+                    ctx->file_name_kind = LOG_FILE_NAME_DYNAMIC;
+                    return;
+                }
+
+                step_unit = LOG_FILE_NAME_SECOND;
+                is_utc = timestamp->is_utc;
+                break;
+            }
+            default:
+                ctx->file_name_kind = LOG_FILE_NAME_DYNAMIC;
+                return;
+        }
+
+        kind = LOG_FILE_NAME_TIME;
+        if(step_unit < unit)
+            unit = step_unit;
+
+        if(is_utc)
+            has_utc = true;
+        else
+            has_local = true;
+    }
+
+    // Local hours and days don't start at the same time as UTC ones everywhere, but minutes do.
+    if(has_utc && has_local && unit > LOG_FILE_NAME_MINUTE)
+        unit = LOG_FILE_NAME_MINUTE;
+
+    ctx->file_name_kind = kind;
+    ctx->file_name_unit = unit;
+    ctx->file_name_utc = has_utc && !has_local;
+}
+
+LOG_EXPORT struct LogFileTargetContext* log_file_target_context_create(char* fname) {
+    struct LogFileTargetContext* ctx = calloc(1, sizeof(*ctx));
+    if(!ctx)
+        return NULL;
+
+    ctx->file_name = mist_log_parse_format(fname, 0, strlen(fname));
+    if(!ctx->file_name) {
+        free(ctx);
+        return NULL;
+    }
+
+    log_file_name_classify(ctx);
+
+    string_init(&ctx->archive_date_format, "");
+
+    ctx->buffer_size = LOG_FILE_BUFFER_SIZE;
+    ctx->flush_interval = (uint64_t)LOG_FILE_FLUSH_INTERVAL * 1000000;
+    ctx->flush_level = LOG_ERROR;
+    ctx->max_open_files = LOG_FILE_MAX_OPEN_FILES;
+
+    return ctx;
+}
+
+static void log_file_close(struct LogFileTargetContext* ctx, struct LogFile* file);
+
+static void log_file_target_context_free_generic(void* ptr) {
+    struct LogFileTargetContext* ctx = ptr;
+    log_file_target_context_free(ctx);
+}
+
+LOG_EXPORT void log_file_target_context_free(struct LogFileTargetContext* ctx) {
+    mist_log_format_free(ctx->file_name);
+
+    if(ctx->archive_file_name)
+        mist_log_format_free(ctx->archive_file_name);
+
+    for(size_t i = 0; i < ctx->files_capacity; i++) {
+        struct LogFile* file = ctx->files[i];
+        if(!file)
+            continue;
+
+        log_timer_cancel(&file->rollover_timer);
+        log_timer_cancel(&file->activity_timer);
+        log_file_close(ctx, file);
+        string_free_resources(&file->name);
+        free(file->buffer);
+        free(file);
+    }
+
+    free(ctx->files);
+
+    // Archive jobs queued by the target may still be updating its manifests.
+    log_jobs_wait();
+
+    string_free_resources(&ctx->archive_date_format);
+    
+    free(ctx);
+}
+
+LOG_EXPORT bool log_file_target_context_archive_fname(struct LogFileTargetContext* ctx, char* archive_fname) {
+    struct LogFormat* format = mist_log_parse_format(archive_fname, 0, strlen(archive_fname));
+    if(!format)
+        return false;
+
+    ctx->archive_file_name = format;
+    return true;
+}
+
+LOG_EXPORT bool log_file_target_context_set_buffering(struct LogFileTargetContext* ctx, size_t size, int mode) {
+    switch(mode) {
+        case _IOFBF:
+            ctx->buffer_size = size == 0 ? LOG_FILE_BUFFER_SIZE : size;
+            return true;
+        case _IOLBF:
+        case _IONBF:
+            // Every message is a line, so line buffering writes each one immediately.
+            ctx->buffer_size = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+LOG_EXPORT void log_file_target_context_set_flush_interval(struct LogFileTargetContext* ctx, uint32_t max_age_ms) {
+    ctx->flush_interval = (uint64_t)max_age_ms * 1000000;
+}
+
+LOG_EXPORT void log_file_target_context_set_flush_level(struct LogFileTargetContext* ctx, enum LogLevel level) {
+    ctx->flush_level = level;
+}
+
+LOG_EXPORT void log_file_target_context_set_max_archive_files(struct LogFileTargetContext* ctx, int max_file_count) {
+    ctx->max_archive_files = max_file_count;
+}
+
+LOG_EXPORT void log_file_target_context_set_max_archive_days(struct LogFileTargetContext* ctx, int max_file_days) {
+    ctx->max_archive_days = max_file_days;
+}
+
+LOG_EXPORT void log_file_target_context_archive_on_size(struct LogFileTargetContext* ctx, size_t max_size) {
+    ctx->archive_timing = FILE_ARCHIVE_SIZE;
+    ctx->archive_above_size = max_size;
+}
+
+LOG_EXPORT void log_file_target_archive_on_date(struct LogFileTargetContext* ctx, enum FileArchiveTiming timing) {
+    ctx->archive_timing = timing;
+}
+
+LOG_EXPORT void log_file_target_context_archive_number_sequence(struct LogFileTargetContext* ctx) {
+    ctx->archive_numbering = FILE_ARCHIVE_NUMBER_SEQUENCE;
+}
+
+LOG_EXPORT bool log_file_target_context_archive_number_date(struct LogFileTargetContext* ctx, char* date_string) {
+    ctx->archive_numbering = FILE_ARCHIVE_NUMBER_DATE;
+    string_clear(&ctx->archive_date_format);
+    return string_append_cstr(&ctx->archive_date_format, date_string);
+}
+
+LOG_EXPORT bool log_file_target_context_keep_files_open(struct LogFileTargetContext* ctx) {
+    ctx->max_open_files = SIZE_MAX;
+    return true;
+}
+
+LOG_EXPORT void log_file_target_context_set_max_open_files(struct LogFileTargetContext* ctx, size_t count) {
+    ctx->max_open_files = count;
+}
+
+LOG_EXPORT void log_file_target_context_set_idle_timeout(struct LogFileTargetContext* ctx, uint32_t timeout_ms) {
+    ctx->idle_timeout = (uint64_t)timeout_ms * 1000000;
+}
+
+// A piece of a write that's passed to the file as is, without being copied into its buffer first.
+struct LogFileChunk {
+    const char* data;
+    size_t length;
+};
+
+// The most chunks written at once: the buffered messages, a message and its newline.
+#define LOG_FILE_MAX_CHUNKS 3
+
+static LogFd log_fd_open(const char* name, bool truncate) {
+#if defined(LOG_WINDOWS)
+
+    int flags = _O_WRONLY | _O_CREAT | _O_APPEND | _O_TEXT | _O_NOINHERIT | (truncate ? _O_TRUNC : 0);
+    return _open(name, flags, _S_IREAD | _S_IWRITE);
+
+#elif defined(LOG_GCC)
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+    int fd;
+    do {
+        fd = open(name, flags, 0644);
+    } while(fd < 0 && errno == EINTR);
+
+    return fd;
+
+#else
+
+    FILE* file = fopen(name, truncate ? "w" : "a");
+
+    // The file is already written in large blocks, so stdio doesn't need to buffer it again.
+    if(file)
+        setvbuf(file, NULL, _IONBF, 0);
+
+    return file;
+
+#endif
+}
+
+static void log_fd_close(LogFd fd) {
+#if defined(LOG_WINDOWS)
+    _close(fd);
+#elif defined(LOG_GCC)
+    close(fd);
+#else
+    fclose(fd);
+#endif
+}
+
+static uint64_t log_fd_size(LogFd fd) {
+#if defined(LOG_WINDOWS)
+
+    __int64 size = _filelengthi64(fd);
+    return size < 0 ? 0 : (uint64_t)size;
+
+#elif defined(LOG_GCC)
+
+    struct stat buffer;
+    return fstat(fd, &buffer) == 0 ? (uint64_t)buffer.st_size : 0;
+
+#else
+
+    // Files are opened for appending, so the position doesn't matter.
+    if(fseek(fd, 0, SEEK_END) != 0)
+        return 0;
+
+    long size = ftell(fd);
+    return size < 0 ? 0 : (uint64_t)size;
+
+#endif
+}
+
+static bool log_fd_write(LogFd fd, const struct LogFileChunk* chunks, int count) {
+#if defined(LOG_GCC)
+
+    struct iovec vectors[LOG_FILE_MAX_CHUNKS];
+    int vector_count = 0;
+    for(int i = 0; i < count; i++) {
+        if(chunks[i].length == 0)
+            continue;
+
+        vectors[vector_count].iov_base = (void*)chunks[i].data;
+        vectors[vector_count].iov_len = chunks[i].length;
+        vector_count++;
+    }
+
+    struct iovec* next = vectors;
+    while(vector_count > 0) {
+        ssize_t written = writev(fd, next, vector_count);
+        if(written < 0) {
+            if(errno == EINTR)
                 continue;
-            }
 
+            return false;
+        }
+
+        // Skip whatever was written before trying again with the rest.
+        while(vector_count > 0 && (size_t)written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            vector_count--;
+        }
+
+        if(vector_count > 0) {
+            next->iov_base = (char*)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return true;
+
+#else
+
+    // There's no gathering write here, so the chunks are written one after another.
+    for(int i = 0; i < count; i++) {
+        const char* data = chunks[i].data;
+        size_t length = chunks[i].length;
+
+        while(length > 0) {
+#if defined(LOG_WINDOWS)
+            unsigned int part = length > INT_MAX ? INT_MAX : (unsigned int)length;
+            int written = _write(fd, data, part);
+            if(written <= 0)
+                return false;
+#else
+            size_t written = fwrite(data, 1, length, fd);
+            if(written == 0)
+                return false;
+#endif
+
+            data += written;
+            length -= written;
+        }
+    }
+
+    return true;
+
+#endif
+}
+
+// Writes the buffered messages of a file.
+static bool log_file_flush(struct LogFile* file) {
+    if(file->buffer_used == 0 || file->fd == LOG_FD_INVALID)
+        return true;
+
+    struct LogFileChunk chunk = { file->buffer, file->buffer_used };
+    file->buffer_used = 0;
+    return log_fd_write(file->fd, &chunk, 1);
+}
+
+static void log_file_lru_unlink(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    if(file->lru_prev)
+        file->lru_prev->lru_next = file->lru_next;
+    else
+        ctx->lru_first = file->lru_next;
+
+    if(file->lru_next)
+        file->lru_next->lru_prev = file->lru_prev;
+    else
+        ctx->lru_last = file->lru_prev;
+
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+}
+
+static void log_file_lru_push(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    file->lru_prev = NULL;
+    file->lru_next = ctx->lru_first;
+    if(ctx->lru_first)
+        ctx->lru_first->lru_prev = file;
+    else
+        ctx->lru_last = file;
+
+    ctx->lru_first = file;
+}
+
+// Writes anything buffered for a file and closes it. Its buffer is released as well, so that
+// only open files hold one.
+static void log_file_close(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    if(file->fd == LOG_FD_INVALID)
+        return;
+
+    log_file_flush(file);
+    log_fd_close(file->fd);
+    file->fd = LOG_FD_INVALID;
+
+    free(file->buffer);
+    file->buffer = NULL;
+    file->buffer_capacity = 0;
+
+    log_file_lru_unlink(ctx, file);
+    ctx->open_count--;
+}
+
+// Makes sure the activity timer of an open file fires in time to flush its buffer or close it once it's idle.
+static void log_file_schedule_activity(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    uint64_t wake = UINT64_MAX;
+    if(file->buffer_used > 0)
+        wake = file->buffer_time + ctx->flush_interval;
+
+    if(ctx->idle_timeout > 0 && file->last_write + ctx->idle_timeout < wake)
+        wake = file->last_write + ctx->idle_timeout;
+
+    // An earlier wake up reschedules the timer itself if needed.
+    if(wake == UINT64_MAX || (file->wake_time != 0 && file->wake_time <= wake))
+        return;
+
+    if(log_timer_schedule(&file->activity_timer, wake))
+        file->wake_time = wake;
+}
+
+// Opens a file, closing the least recently used one if the target already has as many open as it may.
+static bool log_file_reopen(struct LogFileTargetContext* ctx, struct LogFile* file, bool truncate) {
+    if(ctx->max_open_files != 0 && ctx->open_count >= ctx->max_open_files && ctx->lru_last)
+        log_file_close(ctx, ctx->lru_last);
+
+    file->fd = log_fd_open(string_data(&file->name), truncate);
+    if(file->fd == LOG_FD_INVALID)
+        return false;
+
+    file->size = truncate ? 0 : log_fd_size(file->fd);
+
+    log_file_lru_push(ctx, file);
+    ctx->open_count++;
+
+    // Files that are opened without being written to (e.g. when they're archived) are idle from now on.
+    if(ctx->idle_timeout > 0) {
+        file->last_write = log_time_now_ns();
+        log_file_schedule_activity(ctx, file);
+    }
+
+    return true;
+}
+
+// Adds a message to a file. Messages are collected in the file's buffer until it's full, the oldest one
+// is older than the flush interval, or a message at or above the flush level arrives. A message that
+// doesn't fit is written directly after the buffered ones in the same call.
+static bool log_file_write(struct LogFileTargetContext* ctx, struct LogFile* file, const LogEvent* event, String* msg) {
+    size_t length = string_size(msg);
+    file->size += length + 1;
+    file->last_write = event->timestamp;
+
+    // Files that are closed after every message can't keep anything buffered.
+    bool flush = event->level >= ctx->flush_level || ctx->max_open_files == 0 || ctx->buffer_size == 0;
+
+    if(!flush && file->buffer_capacity != ctx->buffer_size) {
+        if(!log_file_flush(file))
+            return false;
+
+        free(file->buffer);
+        file->buffer = NULL;
+        file->buffer_capacity = 0;
+
+        file->buffer = malloc(ctx->buffer_size);
+        if(file->buffer)
+            file->buffer_capacity = ctx->buffer_size;
+    }
+
+    if(!flush && file->buffer_capacity - file->buffer_used > length) {
+        if(file->buffer_used == 0)
+            file->buffer_time = event->timestamp;
+
+        memcpy(file->buffer + file->buffer_used, string_data(msg), length);
+        file->buffer[file->buffer_used + length] = '\n';
+        file->buffer_used += length + 1;
+
+        if(event->timestamp >= file->buffer_time + ctx->flush_interval)
+            return log_file_flush(file);
+
+        log_file_schedule_activity(ctx, file);
+        return true;
+    }
+
+    struct LogFileChunk chunks[LOG_FILE_MAX_CHUNKS] = {
+        { file->buffer, file->buffer_used },
+        { string_data(msg), length },
+        { "\n", 1 }
+    };
+
+    file->buffer_used = 0;
+    return log_fd_write(file->fd, chunks, LOG_FILE_MAX_CHUNKS);
+}
+
+static bool log_file_exists(String* fname) {
+#if defined(LOG_WINDOWS)
+
+    DWORD attribs = GetFileAttributesA(string_data(fname));
+    return attribs != INVALID_FILE_ATTRIBUTES &&
+           !(attribs & FILE_ATTRIBUTE_DIRECTORY);
+
+#elif defined(LOG_GCC)
+
+    return access(string_data(fname), F_OK) == 0;
+
+#else
+    FILE* file = fopen(string_data(fname), "r");
+    if(file) {
+        fclose(file);
+        return true;
+    }
+
+    return false;
+#endif
+}
+
+// The manifest of a log file keeps what archiving needs to know across runs: when the file was created, the
+// number of its last archive and the archives that are still kept. It's a fixed size binary file next to the
+// log file, with the ".li" extension, that is mapped into memory and updated in place.
+
+#define LOG_MANIFEST_MAGIC 0x464D4C4DU
+#define LOG_MANIFEST_VERSION 1
+
+// The most archives a manifest keeps track of. When more are kept, the oldest ones are deleted.
+#define LOG_MANIFEST_CAPACITY 128
+
+// The longest archive name that can be kept track of, including its terminator.
+#define LOG_MANIFEST_NAME_SIZE 256
+
+struct LogManifestEntry {
+    int64_t time;
+    uint64_t size;
+    char name[LOG_MANIFEST_NAME_SIZE];
+};
+
+// A manifest has two copies of its header. Each update is written to the older copy, so a crash in the middle
+// of one leaves the other intact, and the copy with a valid checksum and the highest generation is current.
+// Archive entries are written to free slots of the ring and synced to disk before the header that includes them,
+// which is synced as soon as it's written, so the manifest also survives losing power.
+struct LogManifestHeader {
+    uint64_t generation;
+    int64_t creation_time;
+    int64_t sequence;
+    uint32_t first;
+    uint32_t count;
+    uint64_t checksum;
+};
+
+struct LogManifestData {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t name_size;
+    struct LogManifestHeader headers[2];
+    struct LogManifestEntry entries[LOG_MANIFEST_CAPACITY];
+};
+
+struct LogManifest {
+    struct LogManifestData* data;
+
+    // The current header. Changes to it are written to the file by log_manifest_commit.
+    struct LogManifestHeader header;
+
+#if defined(LOG_WINDOWS)
+    HANDLE file;
+    HANDLE mapping;
+#elif !defined(LOG_GCC)
+    FILE* file;
+#endif
+};
+
+static uint64_t log_manifest_checksum(const struct LogManifestHeader* header) {
+    const unsigned char* bytes = (const unsigned char*)header;
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < offsetof(struct LogManifestHeader, checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool log_manifest_header_valid(const struct LogManifestHeader* header) {
+    return header->checksum == log_manifest_checksum(header)
+        && header->first < LOG_MANIFEST_CAPACITY
+        && header->count <= LOG_MANIFEST_CAPACITY;
+}
+
+// Writes part of a manifest to disk, returning once it's there. Without a mapping, it's only written as far as
+// the C library can take it.
+static void log_manifest_sync(struct LogManifest* manifest, const void* start, size_t size) {
+#if defined(LOG_WINDOWS)
+    if(FlushViewOfFile(start, size))
+        FlushFileBuffers(manifest->file);
+#elif defined(LOG_GCC)
+    // msync only accepts addresses at the start of a page.
+    uintptr_t address = (uintptr_t)start;
+    uintptr_t page = address & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+    msync((void*)page, size + (address - page), MS_SYNC);
+#else
+    long offset = (long)((const char*)start - (const char*)manifest->data);
+    if(fseek(manifest->file, offset, SEEK_SET) == 0 && fwrite(start, 1, size, manifest->file) == size)
+        fflush(manifest->file);
+#endif
+}
+
+static void log_manifest_commit(struct LogManifest* manifest) {
+    struct LogManifestHeader* header = &manifest->header;
+    header->generation++;
+    header->checksum = log_manifest_checksum(header);
+
+    struct LogManifestHeader* copy = manifest->data->headers + (header->generation & 1);
+    *copy = *header;
+    log_manifest_sync(manifest, copy, sizeof(*copy));
+}
+
+// Sidecar files written before manifests were text with lines like "sequence=12". The sequence is carried over
+// so that the next archive doesn't replace an existing one.
+static int64_t log_manifest_text_sequence(const char* text, size_t length) {
+    static const char key[] = "sequence=";
+    size_t key_length = sizeof(key) - 1;
+
+    for(size_t i = 0; i + key_length < length; i++) {
+        if((i == 0 || text[i - 1] == '\n') && memcmp(text + i, key, key_length) == 0) {
+            int64_t sequence = 0;
+            for(i += key_length; i < length && isdigit((unsigned char)text[i]); i++)
+                sequence = sequence * 10 + (text[i] - '0');
+
+            return sequence;
+        }
+    }
+
+    return 0;
+}
+
+// Forgets the oldest archive of a manifest and deletes it.
+static void log_manifest_pop(struct LogManifest* manifest) {
+    struct LogManifestHeader* header = &manifest->header;
+    struct LogManifestEntry* entry = manifest->data->entries + header->first;
+
+    if(memchr(entry->name, '\0', sizeof(entry->name)))
+        remove(entry->name);
+
+    header->first = (header->first + 1) % LOG_MANIFEST_CAPACITY;
+    header->count--;
+}
+
+// Adds an archive to a manifest. It's part of the manifest once the header is committed.
+static bool log_manifest_push(struct LogManifest* manifest, const char* name, size_t length, int64_t time, uint64_t size) {
+    struct LogManifestHeader* header = &manifest->header;
+    if(header->count == LOG_MANIFEST_CAPACITY || length >= LOG_MANIFEST_NAME_SIZE)
+        return false;
+
+    struct LogManifestEntry* entry = manifest->data->entries + (header->first + header->count) % LOG_MANIFEST_CAPACITY;
+    memset(entry->name, 0, sizeof(entry->name));
+    memcpy(entry->name, name, length);
+    entry->time = time;
+    entry->size = size;
+    log_manifest_sync(manifest, entry, sizeof(*entry));
+
+    header->count++;
+    return true;
+}
+
+// Sidecar files also listed the archives that were kept, on a line like "archives=a.log|b.log", or with the time
+// each was made when they were deleted by age ("archives=1700000000?a.log|..."). They're added to the ring so that
+// they're still deleted in turn. Archives without a time are treated as if they were made when they're imported,
+// and the newest ones are kept if there are more than the ring holds.
+static void log_manifest_text_archives(struct LogManifest* manifest, const char* text, size_t length, int64_t now) {
+    static const char key[] = "archives=";
+    size_t key_length = sizeof(key) - 1;
+    const char* end = text + length;
+    const char* part = NULL;
+
+    for(size_t i = 0; i + key_length < length; i++) {
+        if((i == 0 || text[i - 1] == '\n') && memcmp(text + i, key, key_length) == 0) {
+            part = text + i + key_length;
             break;
         }
-
-        name_length++;
     }
 
-    for(int i = 0; i < log_renderer_finder.count; i++) {
-        struct LogLayoutRendererCreator* creator = log_renderer_finder.registered_creators[i];
-        if(strncmp(format + start, creator->name, name_length) == 0) {
-            return creator->create(format, start + name_length + 1, count - name_length - 1, creator->ctx);
+    if(!part)
+        return;
+
+    struct LogManifestHeader* header = &manifest->header;
+    while(part < end && *part != '\n' && *part != '\0') {
+        const char* part_end = part;
+        while(part_end < end && *part_end != '|' && *part_end != '\n' && *part_end != '\0')
+            part_end++;
+
+        const char* name = part;
+        const char* name_end = part_end;
+        while(name_end > name && name_end[-1] == '\r')
+            name_end--;
+
+        int64_t time = now;
+        const char* separator = memchr(name, '?', name_end - name);
+        if(separator) {
+            // The time was written before the name, but some versions read it back the other way around.
+            const char* digits = name;
+            const char* digits_end = separator;
+            while(digits < digits_end && isdigit((unsigned char)*digits))
+                digits++;
+
+            if(digits == digits_end && digits_end > name) {
+                digits = name;
+                name = separator + 1;
+            } else {
+                digits = separator + 1;
+                digits_end = name_end;
+                name_end = separator;
+            }
+
+            int64_t value = 0;
+            const char* digit = digits;
+            for(; digit < digits_end && isdigit((unsigned char)*digit); digit++)
+                value = value * 10 + (*digit - '0');
+
+            if(digit > digits)
+                time = value;
+        }
+
+        if(name_end > name) {
+            // Forget the oldest archive without deleting it, as a manifest that's full would.
+            if(header->count == LOG_MANIFEST_CAPACITY) {
+                header->first = (header->first + 1) % LOG_MANIFEST_CAPACITY;
+                header->count--;
+            }
+
+            log_manifest_push(manifest, name, (size_t)(name_end - name), time, 0);
         }
+
+        part = part_end < end && *part_end == '|' ? part_end + 1 : part_end;
     }
+}
 
-    return NULL;
+static void log_manifest_close(struct LogManifest* manifest) {
+#if defined(LOG_WINDOWS)
+    if(manifest->data)
+        UnmapViewOfFile(manifest->data);
+    if(manifest->mapping)
+        CloseHandle(manifest->mapping);
+    if(manifest->file && manifest->file != INVALID_HANDLE_VALUE)
+        CloseHandle(manifest->file);
+#elif defined(LOG_GCC)
+    if(manifest->data)
+        munmap(manifest->data, sizeof(struct LogManifestData));
+#else
+    free(manifest->data);
+    if(manifest->file)
+        fclose(manifest->file);
+#endif
+
+    free(manifest);
 }
 
-static struct LogLayoutRenderer* mist_log_create_text_renderer(char* format, size_t start, size_t count) {
-    String* part = string_create_ref("");
-    if(!part)
-        return NULL;
+/**
+ * Opens the manifest of a log file, creating it if it doesn't exist yet.
+ */
+static struct LogManifest* log_manifest_open(String* log_name) {
+    String name = string_create("");
+    struct LogManifest* manifest = NULL;
+    size_t previous_size = 0;
 
-    if(!string_append_cstr_part(part, format, start, count)) {
-        string_free(part);
-        return NULL;
+    if(!string_append_string(&name, log_name))
+        goto error;
+
+    size_t ext_start = string_rfind_cstr(&name, 0, ".");
+    if(ext_start != SIZE_MAX)
+        string_erase(&name, ext_start, string_size(&name) - ext_start);
+
+    if(!string_append_cstr(&name, ".li"))
+        goto error;
+
+    manifest = calloc(1, sizeof(*manifest));
+    if(!manifest)
+        goto error;
+
+#if defined(LOG_WINDOWS)
+
+    manifest->file = CreateFileA(
+        string_data(&name),
+        GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+
+    if(manifest->file == INVALID_HANDLE_VALUE)
+        goto error;
+
+    LARGE_INTEGER file_size;
+    if(GetFileSizeEx(manifest->file, &file_size))
+        previous_size = (size_t)file_size.QuadPart;
+
+    // Mapping more than the size of the file extends it.
+    manifest->mapping = CreateFileMappingA(manifest->file, NULL, PAGE_READWRITE, 0, sizeof(struct LogManifestData), NULL);
+    if(!manifest->mapping)
+        goto error;
+
+    manifest->data = MapViewOfFile(manifest->mapping, FILE_MAP_WRITE, 0, 0, sizeof(struct LogManifestData));
+    if(!manifest->data)
+        goto error;
+
+#elif defined(LOG_GCC)
+
+    int fd;
+    do {
+        fd = open(string_data(&name), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    } while(fd < 0 && errno == EINTR);
+
+    if(fd < 0)
+        goto error;
+
+    struct stat buffer;
+    bool sized = fstat(fd, &buffer) == 0;
+    if(sized) {
+        previous_size = (size_t)buffer.st_size;
+        if(previous_size < sizeof(struct LogManifestData))
+            sized = ftruncate(fd, sizeof(struct LogManifestData)) == 0;
     }
-    struct LogLayoutRenderer* step = malloc(sizeof(*step));
-    if(!step) {
-        string_free(part);
+
+    void* view = sized
+        ? mmap(NULL, sizeof(struct LogManifestData), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+
+    // The mapping stays valid after the file is closed.
+    close(fd);
+    if(view == MAP_FAILED)
+        goto error;
+
+    manifest->data = view;
+
+#else
+
+    manifest->file = fopen(string_data(&name), "r+b");
+    if(!manifest->file)
+        manifest->file = fopen(string_data(&name), "w+b");
+    if(!manifest->file)
+        goto error;
+
+    manifest->data = calloc(1, sizeof(struct LogManifestData));
+    if(!manifest->data)
+        goto error;
+
+    previous_size = fread(manifest->data, 1, sizeof(struct LogManifestData), manifest->file);
+
+#endif
+
+    struct LogManifestData* data = manifest->data;
+    if(previous_size < sizeof(*data)
+        || data->magic != LOG_MANIFEST_MAGIC
+        || data->version != LOG_MANIFEST_VERSION
+        || data->capacity != LOG_MANIFEST_CAPACITY
+        || data->name_size != LOG_MANIFEST_NAME_SIZE)
+    {
+        // The ring overlaps the old text, so it's copied before the manifest is reset.
+        size_t text_size = previous_size < sizeof(*data) ? previous_size : sizeof(*data);
+        char* text = text_size > 0 ? malloc(text_size) : NULL;
+        if(text)
+            memcpy(text, data, text_size);
+
+        memset(data, 0, sizeof(*data));
+        data->magic = LOG_MANIFEST_MAGIC;
+        data->version = LOG_MANIFEST_VERSION;
+        data->capacity = LOG_MANIFEST_CAPACITY;
+        data->name_size = LOG_MANIFEST_NAME_SIZE;
+
+        if(text) {
+            manifest->header.sequence = log_manifest_text_sequence(text, text_size);
+            log_manifest_text_archives(manifest, text, text_size, (int64_t)time(NULL));
+            free(text);
+        }
+
+        log_manifest_sync(manifest, data, sizeof(*data));
+        log_manifest_commit(manifest);
+    } else {
+        const struct LogManifestHeader* current = NULL;
+        for(int i = 0; i < 2; i++) {
+            const struct LogManifestHeader* header = data->headers + i;
+            if(log_manifest_header_valid(header) && (!current || header->generation > current->generation))
+                current = header;
+        }
+
+        if(current)
+            manifest->header = *current;
+    }
+
+    string_free_resources(&name);
+    return manifest;
+
+    error:
+        string_free_resources(&name);
+        if(manifest)
+            log_manifest_close(manifest);
+
         return NULL;
+}
+
+#ifdef LOG_WINDOWS
+
+static time_t log_file_time_to_time(FILETIME* ft) {
+    ULARGE_INTEGER ull; 
+    ull.LowPart = ft->dwLowDateTime;
+    ull.HighPart = ft->dwHighDateTime;
+    return ull.QuadPart / 10000000ULL - 11644473600ULL;
+}
+
+#endif
+
+static void log_file_creation_time(struct LogFile* file, struct LogManifest* manifest) {
+#if defined(LOG_WINDOWS)
+
+    WIN32_FILE_ATTRIBUTE_DATA file_data;
+    if(GetFileAttributesExA(string_data(&file->name), GetFileExInfoStandard, &file_data)) {
+        time_t t = log_file_time_to_time(&file_data.ftCreationTime);
+        file->creation_time = *localtime(&t);
+        return;
     }
 
-    step->ctx = part;
-    step->append = log_format_text;
-    step->free = log_format_text_free;
+#elif defined(LOG_GCC) && defined(LOG_STATX)
 
-    return step;
+    struct statx buffer;
+    if(statx(AT_FDCWD, string_data(&file->name), AT_STATX_SYNC_AS_STAT, STATX_BTIME, &buffer) == 0) {
+        time_t t = buffer.stx_btime.tv_sec;
+        file->creation_time = *localtime(&t);
+        return;
+    }
+
+#endif
+
+    if(manifest && manifest->header.creation_time != 0) {
+        time_t t = (time_t)manifest->header.creation_time;
+        file->creation_time = *localtime(&t);
+    }
 }
 
-// ===================
-// SECTION: Formatting
-// ===================
+static void log_file_sequence(struct LogFile* file, struct LogManifest* manifest) {
+    file->sequence = manifest ? (int)manifest->header.sequence + 1 : 1;
+}
 
-struct LogFormat* mist_log_parse_format(char* format, size_t start, size_t count) {
-    if (!log_format_finder_init())
-        return NULL;
-    // "${time:utc=true:format=%x %X} | ${upper:inner=${level}} ${level} | ${file} | ${message}";
-    size_t capacity = 2;
-    size_t renderer_count = 0;
-    struct LogLayoutRenderer** renderers = malloc(sizeof(*renderers) * capacity);
-    if(!renderers)
-        goto error;
+static void log_file_rollover_fire(struct LogTimer* timer, uint64_t now);
+static void log_file_activity_fire(struct LogTimer* timer, uint64_t now);
 
-    size_t format_start = start;
+// Archives a file on the housekeeping thread once its rollover time has passed, even if nothing is logged to it.
+static void log_file_schedule_rollover(struct LogFile* file) {
+    if(file->rollover_time != INT64_MAX)
+        log_timer_schedule(&file->rollover_timer, (uint64_t)file->rollover_time * 1000000000ULL);
+}
 
-    for(size_t iter = 0; iter < count; iter++) {
-        size_t i = iter + start;
-        
-        // A layout renderer escape sequence has been detected. Start creating the renderer.
-        if(iter + 1 < count && format[i] == '$' && format[i + 1] == '{') {
-            // If there was any text before the layout renderer, create a raw
-            // text renderer containing it.
-            if(i != format_start) {
+// Computes when a file is archived next from the time it was created.
+static void log_file_update_rollover_time(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    file->rollover_time = INT64_MAX;
+    if(ctx->archive_timing == FILE_ARCHIVE_NONE || ctx->archive_timing == FILE_ARCHIVE_SIZE)
+        return;
 
-                // Resize the renderers list if the capacity has been reached.
-                if(renderer_count == capacity) {
-                    capacity *= 2;
-                    void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
-                    if(!buffer)
-                        goto error;
-                    renderers = buffer;
-                }
+    struct tm next = file->creation_time;
+    next.tm_isdst = -1;
 
-                struct LogLayoutRenderer* renderer = mist_log_create_text_renderer(format, format_start, i - format_start);
-                if (!renderer)
-                    goto error;
-                renderers[renderer_count++] = renderer;
-            }
+    switch(ctx->archive_timing) {
+        case FILE_ARCHIVE_DAY:
+        case FILE_ARCHIVE_HOUR:
+        case FILE_ARCHIVE_MINUTE: {
+            // These are measured from the creation time rather than the start of the period.
+            time_t created = mktime(&next);
+            if(created == (time_t)-1)
+                return;
 
-            iter += 2;
-            format_start = i + 2;
-            int brace_count = 1;
-            for(; iter < count; iter++) {
-                i = iter + start;
-                // Some renderers have inner renderers that need to be accounted for.
-                // This step makes sure braces are matched correctly accordingly.
-                if(iter + 1 < count && format[i] == '$' && format[i + 1] == '{') {
-                    brace_count++;
-                }
+            int64_t length = ctx->archive_timing == FILE_ARCHIVE_DAY ? 86400 : ctx->archive_timing == FILE_ARCHIVE_HOUR ? 3600 : 60;
+            file->rollover_time = (int64_t)created + length;
+            return;
+        }
+        case FILE_ARCHIVE_MONTH:
+            next.tm_mday = 1;
+            next.tm_mon++;
+            break;
+        case FILE_ARCHIVE_YEAR:
+            next.tm_mday = 1;
+            next.tm_mon = 0;
+            next.tm_year++;
+            break;
+        default: {
+            // The first midnight starting the given weekday after the file was created.
+            int day = ctx->archive_timing - FILE_ARCHIVE_SUNDAY;
+            int days = (day - next.tm_wday + 7) % 7;
+            next.tm_mday += days == 0 ? 7 : days;
+            break;
+        }
+    }
 
-                if(format[i] == '}') {
-                    // If all braces have been matched for the current layer, create a layout renderer
-                    // from the matched string.
-                    if(--brace_count == 0) {
-                        struct LogLayoutRenderer* renderer = mist_log_create_renderer(format, format_start, i - format_start);
-                        if(!renderer)
-                            goto error;
-                        
-                        // Resize the renderers list if the capacity has been reached.
-                        if(renderer_count == capacity) {
-                            capacity *= 2;
-                            void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
-                            if(!buffer)
-                                goto error;
-                            renderers = buffer;
-                        }
+    next.tm_sec = 0;
+    next.tm_min = 0;
+    next.tm_hour = 0;
 
-                        renderers[renderer_count++] = renderer;
-                        break;
-                    }
-                }
+    time_t deadline = mktime(&next);
+    if(deadline != (time_t)-1)
+        file->rollover_time = (int64_t)deadline;
+}
 
-            }
+static size_t log_file_name_hash(const char* name, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
 
-            format_start = i + 1;
+    return (size_t)hash;
+}
+
+static bool log_files_grow(struct LogFileTargetContext* ctx) {
+    size_t capacity = ctx->files_capacity == 0 ? 16 : ctx->files_capacity * 2;
+    struct LogFile** files = calloc(capacity, sizeof(*files));
+    if(!files)
+        return false;
+
+    for(size_t i = 0; i < ctx->files_capacity; i++) {
+        struct LogFile* file = ctx->files[i];
+        if(!file)
+            continue;
+
+        size_t index = file->hash & (capacity - 1);
+        while(files[index])
+            index = (index + 1) & (capacity - 1);
+
+        files[index] = file;
+    }
+
+    free(ctx->files);
+    ctx->files = files;
+    ctx->files_capacity = capacity;
+    return true;
+}
+
+/**
+ * Finds the file with the given name, adding it to the target the first time it is written.
+ */
+static struct LogFile* log_files_find(struct LogFileTargetContext* ctx, String* fname) {
+    size_t hash = log_file_name_hash(string_data(fname), string_size(fname));
+
+    if(ctx->files_capacity > 0) {
+        size_t mask = ctx->files_capacity - 1;
+        for(size_t index = hash & mask; ctx->files[index]; index = (index + 1) & mask) {
+            struct LogFile* file = ctx->files[index];
+            if(file->hash == hash && string_equals_string(&file->name, fname))
+                return file;
         }
     }
 
-    // If there was any text at the end of the string, create a raw text
-    // renderer containing it.
-    if(format_start != start + count) {
-        // Resize the renderers list if the capacity has been reached.
-        if(renderer_count == capacity) {
-            capacity *= 2;
-            void* buffer = realloc(renderers, sizeof(*renderers) * capacity);
-            if(!buffer)
-                goto error;
-            renderers = buffer;
+    // Keep the table at most half full.
+    if((ctx->files_count + 1) * 2 > ctx->files_capacity && !log_files_grow(ctx))
+        return NULL;
+
+    struct LogFile* file = calloc(1, sizeof(*file));
+    if(!file)
+        return NULL;
+
+    file->fd = LOG_FD_INVALID;
+    file->hash = hash;
+    file->rollover_timer.fire = log_file_rollover_fire;
+    file->rollover_timer.ctx = ctx;
+    file->activity_timer.fire = log_file_activity_fire;
+    file->activity_timer.ctx = ctx;
+    string_copy(fname, &file->name);
+
+    bool timed = ctx->archive_timing != FILE_ARCHIVE_NONE && ctx->archive_timing != FILE_ARCHIVE_SIZE;
+    bool numbered = ctx->archive_numbering == FILE_ARCHIVE_NUMBER_SEQUENCE;
+    struct LogManifest* manifest = timed || numbered ? log_manifest_open(fname) : NULL;
+
+    if(timed) {
+        if(log_file_exists(fname)) {
+            log_file_creation_time(file, manifest);
+        } else {
+            time_t t = time(NULL);
+            file->creation_time = *localtime(&t);
         }
+    }
 
-        struct LogLayoutRenderer* renderer = mist_log_create_text_renderer(format, format_start, start + count - format_start);
-        if(!renderer)
-            goto error;
-        renderers[renderer_count++] = renderer;
+    if(numbered) {
+        log_file_sequence(file, manifest);
     }
 
-    // Create the actual log format structure that will contain the layout renderers.
-    struct LogFormat* log_format = malloc(sizeof(*log_format));
-    if(!log_format)
-        goto error;
+    if(manifest)
+        log_manifest_close(manifest);
+
+    log_file_update_rollover_time(ctx, file);
+    log_file_schedule_rollover(file);
+
+    size_t mask = ctx->files_capacity - 1;
+    size_t index = hash & mask;
+    while(ctx->files[index])
+        index = (index + 1) & mask;
+
+    ctx->files[index] = file;
+    ctx->files_count++;
+    return file;
+}
+
+// Computes the time bucket of a time based file name that a second falls in.
+static bool log_file_name_bucket(struct LogFileTargetContext* ctx, time_t second) {
+    static const time_t lengths[] = { 1, 60, 3600, 86400 };
+    time_t length = lengths[ctx->file_name_unit];
+
+    // Seconds and minutes line up in every time zone, as does everything in UTC.
+    if(ctx->file_name_unit <= LOG_FILE_NAME_MINUTE || ctx->file_name_utc) {
+        ctx->file_name_start = second - second % length;
+        ctx->file_name_end = ctx->file_name_start + length;
+        return true;
+    }
+
+    struct tm start;
+    if(!log_time_to_tm(second, false, &start))
+        return false;
+
+    start.tm_sec = 0;
+    start.tm_min = 0;
+    if(ctx->file_name_unit == LOG_FILE_NAME_DAY)
+        start.tm_hour = 0;
+
+    struct tm end = start;
+    if(ctx->file_name_unit == LOG_FILE_NAME_DAY)
+        end.tm_mday++;
+    else
+        end.tm_hour++;
+
+    start.tm_isdst = -1;
+    end.tm_isdst = -1;
+    ctx->file_name_start = mktime(&start);
+    ctx->file_name_end = mktime(&end);
+
+    return ctx->file_name_start != (time_t)-1 && ctx->file_name_end != (time_t)-1
+        && second >= ctx->file_name_start && second < ctx->file_name_end;
+}
+
+/**
+ * Finds the file a message is written to. The name is only rendered when it can't be reused from an earlier message.
+ */
+static struct LogFile* log_file_resolve(struct LogFileTargetContext* ctx, const LogEvent* event) {
+    size_t index = ctx->file_name_kind == LOG_FILE_NAME_CONSTANT ? 0 : (size_t)event->level;
+    bool cacheable = ctx->file_name_kind != LOG_FILE_NAME_DYNAMIC && index <= LOG_FATAL;
+
+    if(cacheable && ctx->file_name_kind == LOG_FILE_NAME_TIME) {
+        time_t second = (time_t)(event->timestamp / 1000000000ULL);
+        if(second < ctx->file_name_start || second >= ctx->file_name_end) {
+            memset(ctx->resolved_files, 0, sizeof(ctx->resolved_files));
+            if(!log_file_name_bucket(ctx, second)) {
+                ctx->file_name_start = 0;
+                ctx->file_name_end = 0;
+                cacheable = false;
+            }
+        }
+    }
 
-    log_format->steps = renderers;
-    log_format->step_count = renderer_count;
+    if(cacheable && ctx->resolved_files[index])
+        return ctx->resolved_files[index];
 
-    return log_format;
+    // The file name is rendered into the calling thread's buffer, which log_files_find copies
+    // if it needs to keep the name.
+    struct LogThreadBuffers* buffers = log_thread_buffers_get();
+    String local_fname;
+    String* fname = &local_fname;
+    if(buffers)
+        fname = &buffers->file_name;
+    else
+        string_init(&local_fname, "");
 
-    error:
-        if(renderers) {
-            for(int i = 0; i < renderer_count; i++) {
-                if(renderers[i]->free != NULL)
-                    renderers[i]->free(renderers[i]->ctx);
-                free(renderers[i]);
-            }
+    string_clear(fname);
+    bool rendered = mist_log_format_event(ctx->file_name, event, fname);
 
-            free(renderers);
-        }
+    struct LogFile* file = rendered ? log_files_find(ctx, fname) : NULL;
 
-        return NULL;
-}
+    if(fname == &local_fname)
+        string_free_resources(&local_fname);
 
-LOG_EXPORT void mist_log_format_free(struct LogFormat* log_format) {
-    if(!log_format)
-        return;
+    if(file && cacheable)
+        ctx->resolved_files[index] = file;
 
-    for(size_t i = 0; i < log_format->step_count; i++) {
-        struct LogLayoutRenderer* renderer = log_format->steps[i];
-        if(renderer->free)
-            renderer->free(renderer->ctx);
-        free(renderer);
-    }
-    free(log_format);
+    return file;
 }
 
-LOG_EXPORT bool mist_log_format(struct LogFormat* log_format, enum LogLevel level, const char* file, const char* function, uint32_t line, String* message, char* format_string, va_list args) {
-    for(int i = 0; i < log_format->step_count; i++) {
-        struct LogLayoutRenderer* step = log_format->steps[i];
-        if(!step->append(level, file, function, line, message, step->ctx, format_string, args)) {
-            string_clear(message);
-            return false;
+// Makes sure a file is open and marks it as the most recently used one.
+static bool log_file_open(struct LogFileTargetContext* ctx, struct LogFile* file) {
+    if(file->fd != LOG_FD_INVALID) {
+        if(ctx->lru_first != file) {
+            log_file_lru_unlink(ctx, file);
+            log_file_lru_push(ctx, file);
         }
+
+        return true;
     }
 
-    return true;
+    return log_file_reopen(ctx, file, false);
 }
 
-LOG_EXPORT Logger* log_logger_create() {
-    Logger* logger = calloc(1, sizeof(*logger));
-    if(!logger)
-        return NULL;
+static bool string_strip_extension(String* value, String* ext) {
+    size_t position = string_rfind_cstr(value, 0, ".");
+    if(position == SIZE_MAX)
+        return false;
 
-    return logger;
+    if(!string_append_string_part(ext, value, position, string_size(value) - position))
+        return false;
+
+    string_erase(value, position, string_size(value) - position);
+    return true;
 }
 
-LOG_EXPORT void log_logger_free(Logger* logger) {
-    for(int i = 0; i < logger->target_count; i++) {
-        log_target_free(logger->targets[i]);
-    }
+// The bookkeeping after a file is archived: updating its manifest and deleting old archives. It's done on the
+// housekeeping thread, so that the thread that archived the file never waits for archives to be deleted.
+// Everything it needs is copied, so it doesn't depend on the target that queued it.
+struct LogArchiveJob {
+    struct LogJob job;
 
-    free(logger);
-}
+    // The name of the log file, which determines the name of its manifest.
+    String name;
+    String archive_name;
 
-LOG_EXPORT void log_target_free(LogTarget* target) {
-    if(!target)
-        return;
+    time_t time;
 
-    struct LogFormat* fmt = target->format;
-    for(int i = 0; i < fmt->step_count; i++) {
-        struct LogLayoutRenderer* renderer = fmt->steps[i];
-        if(renderer->free)
-            renderer->free(renderer->ctx);
-        free(renderer);
+    // The size of the archive.
+    uint64_t size;
+
+    // The number of the archive, or 0 if the archives aren't numbered in sequence.
+    int sequence;
+
+    int max_archive_files;
+    int max_archive_days;
+    bool delete_archives;
+};
+
+static void log_file_delete_old_archives(struct LogManifest* manifest, struct LogArchiveJob* job) {
+    struct LogManifestHeader* header = &manifest->header;
+    struct LogManifestEntry* entries = manifest->data->entries;
+    uint32_t limit = LOG_MANIFEST_CAPACITY;
+    uint32_t count = header->count;
+
+    // Archives are kept in the order they were made, so the old ones are always at the front.
+    if(job->max_archive_days > 0) {
+        while(header->count > 0 && difftime(job->time, (time_t)entries[header->first].time) >= 86400.0 * job->max_archive_days)
+            log_manifest_pop(manifest);
+    } else if(job->max_archive_files > 0 && (uint32_t)job->max_archive_files < limit) {
+        limit = (uint32_t)job->max_archive_files;
     }
-    free(fmt->steps);
-    free(fmt);
 
-    if(target->free)
-        target->free(target->ctx);
+    // Make room for the new archive.
+    while(header->count > 0 && header->count >= limit)
+        log_manifest_pop(manifest);
 
-    free(target);
+    // The slot of the new archive may belong to one that was just deleted, which the file can't refer to
+    // anymore when it's overwritten.
+    if(header->count != count)
+        log_manifest_commit(manifest);
+
+    log_manifest_push(manifest, string_data(&job->archive_name), string_size(&job->archive_name), (int64_t)job->time, job->size);
 }
 
-LOG_EXPORT bool log_add_target(Logger* logger, LogTarget* target) {
-    if(!logger)
-        return false;
-    
-    if(logger->target_count == logger->target_capacity) {
-        int capacity = logger->target_capacity == 0 ? 2 : logger->target_capacity * 2;
-        void* buffer = realloc(logger->targets, sizeof(*logger->targets) * capacity);
-        if(!buffer)
-            return false;
-        
-        logger->targets = buffer;
-        logger->target_capacity = capacity;
+static void log_archive_job_free(struct LogArchiveJob* job) {
+    string_free_resources(&job->name);
+    string_free_resources(&job->archive_name);
+    free(job);
+}
+
+static void log_archive_job_run(struct LogJob* ptr) {
+    struct LogArchiveJob* job = (struct LogArchiveJob*)ptr;
+    struct LogManifest* manifest = log_manifest_open(&job->name);
+
+    if(manifest) {
+        manifest->header.creation_time = (int64_t)job->time;
+        if(job->sequence > 0)
+            manifest->header.sequence = job->sequence;
+
+        if(job->delete_archives)
+            log_file_delete_old_archives(manifest, job);
+
+        log_manifest_commit(manifest);
+        log_manifest_close(manifest);
     }
 
-    logger->targets[logger->target_count++] = target;
-    return true;
+    log_archive_job_free(job);
 }
 
-LOG_EXPORT void log_set_lock(Logger* logger, void* mutex, void (*lock)(void* mtx, bool lock)) {
-    if(!logger)
+static void log_file_archive_impl(struct LogFileTargetContext* ctx, struct LogFile* file, const LogEvent* event) {
+    struct LogArchiveJob* job = calloc(1, sizeof(*job));
+    if(!job)
         return;
 
-    logger->mutex = mutex;
-    logger->lock = lock;
-}
+    job->job.run = log_archive_job_run;
+    string_init(&job->name, "");
+    string_init(&job->archive_name, "");
 
+    String* log_file_name = &job->archive_name;
 
-static bool log_log_impl(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const char* message, va_list args) {
-    if(!logger)
-        return false;
+    // Without an archive name, archives are named after the file itself.
+    bool named = ctx->archive_file_name
+        ? mist_log_format_event(ctx->archive_file_name, event, log_file_name)
+        : string_append_string(log_file_name, &file->name);
 
-    if(logger->mutex && logger->lock)
-        logger->lock(logger->mutex, true);
+    String ext = string_create("");
+    bool has_ext = false;
+    time_t t = time(NULL);
+    bool result = false;
 
-    String output = string_create("");
+    if(!named)
+        goto end;
 
-    for(int i = 0; i < logger->target_count; i++) {
-        LogTarget* target = logger->targets[i];
-        if(log_level < target->min_level || log_level > target->max_level)
-            continue;
+    switch(ctx->archive_numbering) {
+        case FILE_ARCHIVE_NUMBER_NONE:
+            remove(string_data(log_file_name));
+            result = true;
+            break;
+        case FILE_ARCHIVE_NUMBER_SEQUENCE:
+            has_ext = string_strip_extension(log_file_name, &ext);
 
-        string_clear(&output);
-        if(!mist_log_format(target->format, log_level, file, function, line, &output, message, args))
-            return false;
+            if(!string_format_cstr(log_file_name, ".%d", file->sequence))
+                break;
+            
+            if(has_ext && !string_append_string(log_file_name, &ext))
+                break;
+
+            result = true;
+            break;
+        case FILE_ARCHIVE_NUMBER_DATE: {
+            char datetime[256];
+            struct tm time_value = *localtime(&t);
+            size_t count = strftime(datetime, 256, string_data(&ctx->archive_date_format), &time_value);
+            if(count == 0)
+                break;
+
+            has_ext = string_strip_extension(log_file_name, &ext);
+            if( !string_append_cstr(log_file_name, ".") || 
+                !string_append_cstr_part(log_file_name, datetime, 0, count)) 
+            {
+                break;
+            }
 
-        target->log(log_level, file, function, line, &output, target->ctx);
+            if(has_ext && !string_append_string(log_file_name, &ext))
+                break;
+
+            result = true;
+            break;
+        }
     }
 
-    string_free_resources(&output);
+    if(result) {
+        // Anything still buffered belongs to the file being archived.
+        bool was_open = file->fd != LOG_FD_INVALID;
+        log_file_close(ctx, file);
+        job->size = file->size;
 
-    if(logger->mutex && logger->lock)
-        logger->lock(logger->mutex, false);
+        // A file that couldn't be renamed is written to further, so that nothing in it is lost.
+        bool renamed = rename(string_data(&file->name), string_data(log_file_name)) == 0;
+        if(renamed)
+            file->size = 0;
 
-    return true;
-}
+        if(was_open)
+            log_file_reopen(ctx, file, renamed);
 
-LOG_EXPORT bool mist_log_string(Logger* logger, enum LogLevel log_level, const char* file, int line, const String* message, ...) {
-    va_list args;
-    va_start(args, message);
+        // The next archive is attempted at the next rollover either way.
+        if(ctx->archive_timing != FILE_ARCHIVE_NONE && ctx->archive_timing != FILE_ARCHIVE_SIZE) {
+            file->creation_time = *localtime(&t);
+            log_file_update_rollover_time(ctx, file);
+            log_file_schedule_rollover(file);
+        }
 
-    bool result = log_log_impl(logger, log_level, file, "", line, string_data(message), args);
+        if(!renamed)
+            goto end;
 
-    va_end(args);
+        if(ctx->archive_numbering == FILE_ARCHIVE_NUMBER_SEQUENCE)
+            job->sequence = file->sequence++;
+
+        // Everything else is left to the housekeeping thread.
+        job->time = t;
+        job->max_archive_files = ctx->max_archive_files;
+        job->max_archive_days = ctx->max_archive_days;
+        job->delete_archives = ctx->archive_numbering != FILE_ARCHIVE_NUMBER_NONE
+            && (ctx->max_archive_files > 0 || ctx->max_archive_days > 0);
+
+        if(string_append_string(&job->name, &file->name)) {
+            log_job_post(&job->job);
+            job = NULL;
+        }
+    }
 
-    return result;
+    end:
+        string_free_resources(&ext);
+
+        if(job)
+            log_archive_job_free(job);
 }
 
-LOG_EXPORT bool mist_log_func_string(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const String* message, ...) {
-    va_list args;
-    va_start(args, message);
+static void log_file_archive(struct LogFileTargetContext* ctx, struct LogFile* file, const LogEvent* event) {
+    log_file_archive_impl(ctx, file, event);
+}
 
-    bool result = log_log_impl(logger, log_level, file, function, line, string_data(message), args);
+static void log_file_archive_if_needed(struct LogFileTargetContext* ctx, struct LogFile* file, const LogEvent* event) {
+    if(ctx->archive_timing == FILE_ARCHIVE_NONE)
+        return;
 
-    va_end(args);
+    if(ctx->archive_timing == FILE_ARCHIVE_SIZE) {
+        if(file->size >= ctx->archive_above_size)
+            log_file_archive(ctx, file, event);
+    } else if((int64_t)(event->timestamp / 1000000000ULL) >= file->rollover_time) {
+        log_file_archive(ctx, file, event);
+    }
+}
 
-    return result;
+// The file of a timer is found from the address of the timer.
+#define LOG_FILE_FROM_TIMER(timer, member) ((struct LogFile*)((char*)(timer) - offsetof(struct LogFile, member)))
+
+// How long the housekeeping thread waits before trying again when a file target is busy.
+#define LOG_FILE_RETRY_NS (50 * 1000000ULL)
+
+static void log_file_rollover_fire(struct LogTimer* timer, uint64_t now) {
+    struct LogFileTargetContext* ctx = timer->ctx;
+    struct LogFile* file = LOG_FILE_FROM_TIMER(timer, rollover_timer);
+
+    // The thread logging to the target may be waiting for the timers to take its own turn.
+    if(!log_lock_try_acquire(&ctx->lock_state)) {
+        log_timer_schedule(timer, now + LOG_FILE_RETRY_NS);
+        return;
+    }
+
+    if((int64_t)(now / 1000000000ULL) < file->rollover_time) {
+        log_file_schedule_rollover(file);
+    } else if(file->size == 0) {
+        // Nothing was written since the last archive, so there's nothing to archive either.
+        time_t t = (time_t)(now / 1000000000ULL);
+        file->creation_time = *localtime(&t);
+        log_file_update_rollover_time(ctx, file);
+        log_file_schedule_rollover(file);
+    } else {
+        // Archive names are rendered from an event, which only has the time of the rollover.
+        String message = string_create("");
+        LogEvent event;
+        memset(&event, 0, sizeof(event));
+        event.level = LOG_INFO;
+        event.file = "";
+        event.function = "";
+        event.timestamp = now;
+        event.message = &message;
+
+        log_file_archive(ctx, file, &event);
+        string_free_resources(&message);
+    }
+
+    log_lock_release(&ctx->lock_state);
 }
 
-LOG_EXPORT bool mist_log_cstr(Logger* logger, enum LogLevel log_level, const char* file, int line, const char* message, ...) {
-    va_list args;
-    va_start(args, message);
+static void log_file_activity_fire(struct LogTimer* timer, uint64_t now) {
+    struct LogFileTargetContext* ctx = timer->ctx;
+    struct LogFile* file = LOG_FILE_FROM_TIMER(timer, activity_timer);
 
-    bool result = log_log_impl(logger, log_level, file, "", line, message, args);
+    if(!log_lock_try_acquire(&ctx->lock_state)) {
+        log_timer_schedule(timer, now + LOG_FILE_RETRY_NS);
+        return;
+    }
 
-    va_end(args);
+    file->wake_time = 0;
+    if(file->fd != LOG_FD_INVALID) {
+        if(file->buffer_used > 0 && now >= file->buffer_time + ctx->flush_interval)
+            log_file_flush(file);
 
-    return result;
+        if(ctx->idle_timeout > 0 && now >= file->last_write + ctx->idle_timeout)
+            log_file_close(ctx, file);
+        else
+            log_file_schedule_activity(ctx, file);
+    }
+
+    log_lock_release(&ctx->lock_state);
 }
 
-LOG_EXPORT bool mist_log_func_cstr(Logger* logger, enum LogLevel log_level, const char* file, const char* function, int line, const char* message, ...) {
-    va_list args;
-    va_start(args, message);
+LOG_EXPORT void log_file_target_context_flush(struct LogFileTargetContext* ctx) {
+    log_lock_acquire(&ctx->lock_state);
 
-    bool result = log_log_impl(logger, log_level, file, function, line, message, args);
+    // Only open files have anything buffered.
+    for(struct LogFile* file = ctx->lru_first; file; file = file->lru_next)
+        log_file_flush(file);
 
-    va_end(args);
+    log_lock_release(&ctx->lock_state);
+}
 
-    return result;
+static void log_file_flush_all(void* ctx) {
+    log_file_target_context_flush(ctx);
 }
 
-// ====================
-// SECTION: Log Targets
-// ====================
+static void log_file_log(const LogEvent* event, String* msg, void* ptr) {
+    struct LogFileTargetContext* ctx = ptr;
 
-static void log_console_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ctx) {
-    puts(string_data(msg));
+    log_lock_acquire(&ctx->lock_state);
+
+    struct LogFile* log_file = log_file_resolve(ctx, event);
+    if(!log_file || !log_file_open(ctx, log_file)) {
+        log_lock_release(&ctx->lock_state);
+        return;
+    }
+
+    log_file_write(ctx, log_file, event, msg);
+
+    if(ctx->max_open_files == 0)
+        log_file_close(ctx, log_file);
+
+    log_file_archive_if_needed(ctx, log_file, event);
+
+    log_lock_release(&ctx->lock_state);
 }
 
-LogTarget* log_target_console_create(const char* layout, enum LogLevel min_level, enum LogLevel max_level) {
+LOG_EXPORT LogTarget* log_target_file_create(const char* layout, enum LogLevel min_level, enum LogLevel max_level, struct LogFileTargetContext* ctx) {
     LogTarget* target = malloc(sizeof(*target));
     if(!target)
         return NULL;
 
-    struct LogFormat* fmt = mist_log_parse_format(layout, 0, strlen(layout));
+    struct LogFormat* fmt = log_format_intern(layout);
     if(!fmt) {
         free(target);
         return NULL;
     }
 
-    target->format = fmt;
-    target->free = NULL;
-    target->ctx = NULL;
-    target->log = log_console_log;
-    target->min_level = min_level;
-    target->max_level = max_level;
+    log_target_init(target, fmt, min_level, max_level);
+    target->free = log_file_target_context_free;
+    target->flush = log_file_flush_all;
+    target->ctx = ctx;
+    target->log_event = log_file_log;
 
     return target;
 }
 
-LOG_EXPORT struct LogFileTargetContext* log_file_target_context_create(char* fname) {
-    struct LogFileTargetContext* ctx = calloc(1, sizeof(*ctx));
-    if(!ctx)
-        return NULL;
+// =======================
+// SECTION: Binary Logging
+// =======================
+
+// Binary log files start with a header, followed by a stream of records:
+//
+//   Header: "MLOG" <version:u8> <base time in ns since the epoch:varint>
+//   Site:   0x01 <site id:varint> <level:u8> <line:varint> <file:string> <function:string> <format:string>
+//   Event:  0x02 <site id:varint> <ns since the base time:varint> <argument bytes:varint> <arguments>
+//
+// Strings are a varint length followed by the characters. The arguments use the LogArgs encoding,
+// without the format string which is stored once in the site record.
+// A header can appear again later in the file (e.g. when a file is appended to), which resets the sites.
+//
+// Site records are written as soon as a site is first seen, separately from the event that uses it, so that
+// they are in the file even if that event is dropped. Version 1 files stored the time since the previous
+// event instead of the time since the base, which drifted when an encoded event was dropped.
+
+#define LOG_BINARY_MAGIC "MLOG"
+#define LOG_BINARY_VERSION 2
+#define LOG_BINARY_SITE 0x01
+#define LOG_BINARY_EVENT 0x02
+
+struct LogBinarySite {
+    const char* format;
+    const char* file;
+    uint32_t line;
+    enum LogLevel level;
+    uint32_t id;
+
+    // Copy of the format text the site was defined with, used to detect formats that
+    // reuse the same buffer for different text.
+    char* format_text;
+};
 
-    ctx->file_name = mist_log_parse_format(fname, 0, strlen(fname));
-    if(!ctx->file_name) {
-        free(ctx);
-        return NULL;
+struct LogBinaryWriter {
+    FILE* file;
+
+    // The time events are stored relative to, from the header of the file.
+    uint64_t base_time;
+
+    struct LogBinarySite* sites;
+    size_t site_count;
+    size_t site_capacity;
+    uint32_t next_site_id;
+
+    struct LogArgs args;
+};
+
+static bool log_binary_append_varint(String* output, uint64_t value) {
+    char bytes[10];
+    size_t count = 0;
+
+    while(value >= 0x80) {
+        bytes[count++] = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
     }
+    bytes[count++] = (char)value;
 
-    string_init(&ctx->archive_date_format, "");
-    return ctx;
+    return string_append_cstr_part(output, bytes, 0, count);
 }
 
-static void log_file_target_context_free_generic(void* ptr) {
-    struct LogFileTargetContext* ctx = ptr;
-    log_file_target_context_free(ctx);
+static bool log_binary_append_string(String* output, const char* value) {
+    size_t length = strlen(value);
+    return log_binary_append_varint(output, length) && string_append_cstr_part(output, value, 0, length);
 }
 
-LOG_EXPORT void log_file_target_context_free(struct LogFileTargetContext* ctx) {
-    mist_log_format_free(ctx->file_name);
+static size_t log_binary_site_hash(const char* format, const char* file, uint32_t line, enum LogLevel level) {
+    size_t hash = (size_t)(uintptr_t)format * 31 + (size_t)(uintptr_t)file;
+    return (hash * 31 + line) * 31 + level;
+}
 
-    if(ctx->archive_file_name)
-        mist_log_format_free(ctx->archive_file_name);
+static bool log_binary_sites_grow(struct LogBinaryWriter* writer) {
+    size_t capacity = writer->site_capacity == 0 ? 64 : writer->site_capacity * 2;
+    struct LogBinarySite* sites = calloc(capacity, sizeof(*sites));
+    if(!sites)
+        return false;
 
-    if(ctx->files) {
-        for(size_t i = 0; i < ctx->files_count; i++) {
-            struct LogFile* file = ctx->files + i;
-            if(file->file)
-                fclose(file->file);
-            string_free_resources(&file->name);
-            free(file->buffer);
-        }
+    for(size_t i = 0; i < writer->site_capacity; i++) {
+        struct LogBinarySite* site = writer->sites + i;
+        if(!site->format)
+            continue;
+
+        size_t index = log_binary_site_hash(site->format, site->file, site->line, site->level) & (capacity - 1);
+        while(sites[index].format)
+            index = (index + 1) & (capacity - 1);
 
-        free(ctx->files);
+        sites[index] = *site;
     }
 
-    string_free_resources(&ctx->archive_date_format);
-    
-    free(ctx);
+    free(writer->sites);
+    writer->sites = sites;
+    writer->site_capacity = capacity;
+    return true;
 }
 
-LOG_EXPORT bool log_file_target_context_archive_fname(struct LogFileTargetContext* ctx, char* archive_fname) {
-    struct LogFormat* format = mist_log_parse_format(archive_fname, 0, strlen(archive_fname));
-    if(!format)
-        return false;
+/**
+ * Finds the site of a log call, writing a site record to the file the first time it is seen.
+ */
+static struct LogBinarySite* log_binary_find_site(
+    struct LogBinaryWriter* writer,
+    enum LogLevel level,
+    const char* file,
+    const char* function,
+    uint32_t line,
+    const char* format)
+{
+    // Keep the table at most half full.
+    if((writer->site_count + 1) * 2 > writer->site_capacity && !log_binary_sites_grow(writer))
+        return NULL;
 
-    ctx->archive_file_name = format;
-    return true;
-}
+    size_t mask = writer->site_capacity - 1;
+    size_t index = log_binary_site_hash(format, file, line, level) & mask;
+    struct LogBinarySite* site;
 
-LOG_EXPORT bool log_file_target_context_set_buffering(struct LogFileTargetContext* ctx, size_t size, int mode) {
-    if(ctx->custom_buffering && ctx->buffer_mode != _IONBF) {
-        free(ctx->buffer);
-        ctx->buffer = NULL;
-    }
-    
-    if(mode != _IONBF) {
+    while(true) {
+        site = writer->sites + index;
+        if(!site->format)
+            break;
 
-        if(size == 0)
-        {
-            ctx->custom_buffering = false;
-            return true;
-        } else {
-            char* buffer = malloc(size);
-            if(!buffer)
-                return false;
+        if(site->format == format && site->file == file && site->line == line && site->level == level) {
+            if(strcmp(site->format_text, format) == 0)
+                return site;
 
-            ctx->buffer = buffer;
-            ctx->buffer_size = size;
+            // Same call site, but the format buffer now holds different text. Redefine the site.
+            break;
         }
+
+        index = (index + 1) & mask;
     }
 
-    ctx->buffer_mode = mode;
-    ctx->custom_buffering = true;
-    return true;
-}
+    size_t format_length = strlen(format);
+    char* format_text = malloc(format_length + 1);
+    if(!format_text)
+        return NULL;
+    memcpy(format_text, format, format_length + 1);
+
+    // The site is only added once its record is in the file, so every event that refers to it can be read back.
+    String record = string_create("");
+    char tag = LOG_BINARY_SITE;
+    char level_byte = (char)level;
+    bool written = string_append_cstr_part(&record, &tag, 0, 1)
+        && log_binary_append_varint(&record, writer->next_site_id)
+        && string_append_cstr_part(&record, &level_byte, 0, 1)
+        && log_binary_append_varint(&record, line)
+        && log_binary_append_string(&record, file)
+        && log_binary_append_string(&record, function)
+        && log_binary_append_string(&record, format)
+        && fwrite(string_data(&record), 1, string_size(&record), writer->file) == string_size(&record);
+    string_free_resources(&record);
+
+    if(!written) {
+        free(format_text);
+        return NULL;
+    }
 
-LOG_EXPORT void log_file_target_context_set_max_archive_files(struct LogFileTargetContext* ctx, int max_file_count) {
-    ctx->max_archive_files = max_file_count;
-}
+    if(site->format)
+        free(site->format_text);
+    else
+        writer->site_count++;
 
-LOG_EXPORT void log_file_target_context_set_max_archive_days(struct LogFileTargetContext* ctx, int max_file_days) {
-    ctx->max_archive_days = max_file_days;
-}
+    site->format = format;
+    site->file = file;
+    site->line = line;
+    site->level = level;
+    site->id = writer->next_site_id++;
+    site->format_text = format_text;
 
-LOG_EXPORT void log_file_target_context_archive_on_size(struct LogFileTargetContext* ctx, size_t max_size) {
-    ctx->archive_timing = FILE_ARCHIVE_SIZE;
-    ctx->archive_above_size = max_size;
+    return site;
 }
 
-LOG_EXPORT void log_file_target_archive_on_date(struct LogFileTargetContext* ctx, enum FileArchiveTiming timing) {
-    ctx->archive_timing = timing;
-}
+// Stores an already rendered message against a "%s" site for the call that logged it.
+static struct LogBinarySite* log_binary_pack_text(struct LogBinaryWriter* writer, const LogEvent* event, const char* text, size_t length) {
+    writer->args.size = 0;
 
-LOG_EXPORT void log_file_target_context_archive_number_sequence(struct LogFileTargetContext* ctx) {
-    ctx->archive_numbering = FILE_ARCHIVE_NUMBER_SEQUENCE;
-}
+    struct LogBinarySite* site = log_binary_find_site(writer, event->level, event->file, event->function, event->line, "%s");
+    if(!site || !log_args_append_string(&writer->args, text, length))
+        return NULL;
 
-LOG_EXPORT bool log_file_target_context_archive_number_date(struct LogFileTargetContext* ctx, char* date_string) {
-    ctx->archive_numbering = FILE_ARCHIVE_NUMBER_DATE;
-    string_clear(&ctx->archive_date_format);
-    return string_append_cstr(&ctx->archive_date_format, date_string);
+    return site;
 }
 
-LOG_EXPORT bool log_file_target_context_keep_files_open(struct LogFileTargetContext* ctx) {
-    ctx->keep_files_open = true;
+static bool log_format_binary_event(const LogEvent* event, String* output, void* ctx) {
+    struct LogBinaryWriter* writer = ctx;
+    struct LogBinarySite* site = NULL;
+
+    if(!event->args) {
+        // The writer thread of an asynchronous logger only has the rendered message.
+        const String* message = event->message;
+        site = log_binary_pack_text(writer, event, message ? string_data(message) : "", message ? string_size(message) : 0);
+    } else {
+        site = log_binary_find_site(writer, event->level, event->file, event->function, event->line, event->format);
+        if(!site)
+            return false;
+
+        va_list copy;
+        va_copy(copy, *event->args);
+
+        writer->args.size = 0;
+        bool packed = log_args_pack_values(&writer->args, event->format, copy);
+        va_end(copy);
+
+        if(!packed) {
+            // The arguments can't be stored as is, so format the message here instead.
+            String text = string_create("");
+            va_copy(copy, *event->args);
+            site = string_format_args_cstr(&text, event->format, copy) != NULL
+                ? log_binary_pack_text(writer, event, string_data(&text), string_size(&text))
+                : NULL;
+            va_end(copy);
+            string_free_resources(&text);
+        }
+    }
 
-    int capacity = 2;
-    ctx->files = malloc(sizeof(*ctx->files) * capacity);
-    if(!ctx->files)
+    if(!site)
         return false;
 
-    ctx->files_capacity = capacity;
+    uint64_t offset = event->timestamp > writer->base_time ? event->timestamp - writer->base_time : 0;
 
-    return true;
+    char tag = LOG_BINARY_EVENT;
+    return string_append_cstr_part(output, &tag, 0, 1)
+        && log_binary_append_varint(output, site->id)
+        && log_binary_append_varint(output, offset)
+        && log_binary_append_varint(output, writer->args.size)
+        && string_append_cstr_part(output, (const char*)writer->args.data, 0, writer->args.size);
 }
 
-static bool log_file_exists(String* fname) {
-#if defined(LOG_WINDOWS)
-
-    DWORD attribs = GetFileAttributesA(string_data(fname));
-    return attribs != INVALID_FILE_ATTRIBUTES &&
-           !(attribs & FILE_ATTRIBUTE_DIRECTORY);
+static void log_binary_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ctx) {
+    struct LogBinaryWriter* writer = ctx;
+    FILE* stream = writer->file;
 
+    // The writer thread of an asynchronous logger writes events while site records are written by the threads
+    // that log them, so the file stays locked until the event is either complete or removed again.
+#if defined(LOG_WINDOWS)
+    _lock_file(stream);
 #elif defined(LOG_GCC)
+    flockfile(stream);
+#endif
 
-    return access(string_data(fname), F_OK) == 0;
-
-#else
-    FILE* file = fopen(string_data(fname), "r");
-    if(file) {
-        fclose(file);
-        return true;
+    // A partial record would make the rest of the file unreadable, so it's cut off where the record started.
+    long start = ftell(stream);
+    if(fwrite(string_data(msg), 1, string_size(msg), stream) != string_size(msg) && start >= 0) {
+        clearerr(stream);
+        fflush(stream);
+#if defined(LOG_WINDOWS)
+        _chsize_s(_fileno(stream), start);
+#elif defined(LOG_GCC)
+        if(ftruncate(fileno(stream), start) != 0)
+            clearerr(stream);
+#endif
     }
 
-    return false;
+#if defined(LOG_WINDOWS)
+    _unlock_file(stream);
+#elif defined(LOG_GCC)
+    funlockfile(stream);
 #endif
 }
 
-static bool log_file_info_attribute(struct LogFile* file, char* attrib, String* value) {
-    size_t ext_start = string_rfind_cstr(&file->name, 0, ".");
-    String log_info = string_create("");
-    if(!string_append_string(&log_info, &file->name))
-        return false;
-    
-    if(ext_start != SIZE_MAX) {
-        string_erase(&log_info, ext_start, string_size(&log_info) - ext_start);
-    }
+static void log_binary_flush(void* ctx) {
+    struct LogBinaryWriter* writer = ctx;
+    fflush(writer->file);
+}
 
-    if(!string_append_cstr(&log_info, ".li")) {
-        string_free_resources(&log_info);
-        return false;
-    }
+static void log_binary_writer_free(void* ctx) {
+    struct LogBinaryWriter* writer = ctx;
 
-    FILE* log_info_file = fopen(string_data(&log_info), "r");
-    if(!log_info_file) {
-        string_free_resources(&log_info);
-        return false;
-    }
+    if(writer->file)
+        fclose(writer->file);
 
-    size_t attrib_length = strlen(attrib);
+    for(size_t i = 0; i < writer->site_capacity; i++)
+        free(writer->sites[i].format_text);
 
-    // Prefer getLine implementation if possible to avoid reading whole file into program.
-#ifdef LOG_GCC
+    free(writer->sites);
+    log_args_free_resources(&writer->args);
+    free(writer);
+}
 
-    char* line;
-    size_t line_buf_size;
-    ssize_t line_size;
+LOG_EXPORT LogTarget* log_target_binary_create(const char* fname, enum LogLevel min_level, enum LogLevel max_level) {
+    LogTarget* target = NULL;
+    struct LogFormat* fmt = NULL;
+    struct LogLayoutRenderer* renderer = NULL;
 
-    bool result = false;
+    struct LogBinaryWriter* writer = calloc(1, sizeof(*writer));
+    if(!writer)
+        return NULL;
 
-    while((line_size = getLine(&line, &line_buf_size, log_info_file)) != -1) {
-        if(strncmp(line, attrib, attrib_length) == 0) {
-            if(line_size >= attrib_length + 1) {
-                if(!string_append_cstr_part(value, line, attrib_length + 1, line_size - attrib_length - 1))
-                    break;
-                
-                result = true;
-                break;
-            }
-        }
-    }
+    writer->file = fopen(fname, "ab");
+    if(!writer->file)
+        goto error;
 
-    free(line);
-    string_free_resources(&log_info);
-    fclose(log_info_file);
-    return result;
+    target = malloc(sizeof(*target));
+    fmt = calloc(1, sizeof(*fmt));
+    renderer = malloc(sizeof(*renderer));
+    if(!target || !fmt || !renderer)
+        goto error;
 
-#else
+    fmt->steps = malloc(sizeof(*fmt->steps));
+    if(!fmt->steps)
+        goto error;
 
-    if(fseek(log_info_file, 0, SEEK_END) == 0) {
-        int64_t fsize = ftell(log_info_file);
-        if(fsize == -1) {
-            string_free_resources(&log_info);
-            fclose(log_info_file);
-            return false;
-        }
+    // The writer is owned by the target, so the renderer doesn't free it.
+    renderer->append = NULL;
+    renderer->append_event = log_format_binary_event;
+    renderer->free = NULL;
+    renderer->ctx = writer;
+
+    fmt->steps[0] = renderer;
+    fmt->step_count = 1;
+    fmt->program = NULL;
+    fmt->program_size = 0;
+    fmt->uses_message = false;
+
+    // The writer's sites and times must be encoded in the order the messages are written.
+    fmt->stateful = true;
+
+    // Every writer starts a new segment in the file.
+    String header = string_create(LOG_BINARY_MAGIC);
+    char version = LOG_BINARY_VERSION;
+    writer->base_time = log_time_now_ns();
+    bool result = string_append_cstr_part(&header, &version, 0, 1)
+        && log_binary_append_varint(&header, writer->base_time)
+        && fwrite(string_data(&header), 1, string_size(&header), writer->file) == string_size(&header);
+    string_free_resources(&header);
+
+    if(!result)
+        goto error;
 
-        String file_contents = string_create("");
-        if(!string_reserve(&file_contents, fsize)) {
-            string_free_resources(&log_info);
-            fclose(log_info_file);
-            return false;
-        }
+    log_target_init(target, fmt, min_level, max_level);
+    target->free = log_binary_writer_free;
+    target->flush = log_binary_flush;
+    target->ctx = writer;
+    target->log = log_binary_log;
 
-        if(fseek(log_info_file, 0, SEEK_SET) != 0) {
-            string_free_resources(&log_info);
-            string_free_resources(&file_contents);
-            fclose(log_info_file);
-            return false;
-        }
+    return target;
 
-        size_t file_read_length = fread(string_cstr(&file_contents), sizeof(char), fsize, log_info_file);
-        if(ferror(log_info_file) != 0) {
-            string_free_resources(&log_info);
-            string_free_resources(&file_contents);
-            fclose(log_info_file);
-            return false;
-        }
+    error:
+        if(fmt)
+            free(fmt->steps);
+        free(fmt);
+        free(renderer);
+        free(target);
+        log_binary_writer_free(writer);
+        return NULL;
+}
 
-        string_cstr(&file_contents)[file_read_length] = '\0';
-        if(sso_string_is_long(&file_contents))
-            sso_string_long_set_size(&file_contents, file_read_length);
-        else
-            sso_string_short_set_size(&file_contents, file_read_length);
-
-        String new_line = string_create("\n");
-        int line_count;
-        String* lines = string_split(&file_contents, &new_line, NULL, -1, &line_count, true, true);
-        if(!lines) {
-            string_free_resources(&log_info);
-            string_free_resources(&file_contents);
-            fclose(log_info_file);
+static bool log_binary_read_varint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if(c == EOF)
             return false;
-        }
 
-        bool found = false;
-        for(size_t i = 0; i < line_count; i++) {
-            if(!found && string_starts_with_cstr(lines + i, attrib))
-                found = string_append_string_part(value, lines + i, attrib_length + 1, string_size(lines + i) - attrib_length - 1);
-
-            string_free_resources(lines + i);
-        }
-
-        free(lines);
-        string_free_resources(&log_info);
-        string_free_resources(&file_contents);
-        fclose(log_info_file);
-        return found;
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if(!(c & 0x80))
+            return true;
     }
 
-    string_free_resources(&log_info);
-    fclose(log_info_file);
     return false;
-
-#endif
 }
 
-static bool log_file_info_handle_attribute(
-    struct LogFile* file, 
-    char* attrib, 
-    void* ctx, 
-    void (*handle_attrib)(FILE* file, String* current_line, char* attrib, void* ctx))
-{
-    size_t ext_start = string_rfind_cstr(&file->name, 0, ".");
-    String log_info = string_create("");
-    if(!string_append_string(&log_info, &file->name))
-        return false;
-    
-    if(ext_start != SIZE_MAX) {
-        string_erase(&log_info, ext_start, string_size(&log_info) - ext_start);
-    }
+static char* log_binary_read_string(FILE* file) {
+    uint64_t length;
+    if(!log_binary_read_varint(file, &length))
+        return NULL;
 
-    if(!string_append_cstr(&log_info, ".li")) {
-        string_free_resources(&log_info);
-        return false;
-    }
+    char* value = malloc(length + 1);
+    if(!value)
+        return NULL;
 
-    FILE* log_info_file = fopen(string_data(&log_info), "a+");
-    if(!log_info_file) {
-        string_free_resources(&log_info);
-        return false;
+    if(fread(value, 1, length, file) != length) {
+        free(value);
+        return NULL;
     }
 
-    size_t attrib_length = strlen(attrib);
+    value[length] = '\0';
+    return value;
+}
 
-// Prefer getLine implementation if possible to avoid reading whole file into program.
-#ifdef LOG_GCC
+struct LogBinaryReaderSite {
+    enum LogLevel level;
+    uint32_t line;
+    char* file;
+    char* function;
+    char* format;
+};
 
-    char* line;
-    size_t line_buf_size;
-    ssize_t line_size;
+static void log_binary_reader_sites_clear(struct LogBinaryReaderSite* sites, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        free(sites[i].file);
+        free(sites[i].function);
+        free(sites[i].format);
+    }
 
-    bool result = true;
+    if(count > 0)
+        memset(sites, 0, sizeof(*sites) * count);
+}
 
-    fseek(log_info_file, 0, SEEK_SET);
+// Logs a decoded message with the time it was originally logged at.
+static bool log_binary_replay_event(Logger* logger, LogEvent* event, ...) {
+    va_list args;
+    va_start(args, event);
 
-    // Create a temporary file to copy the old data over to. This is the only
-    // way to replace existing data unfortunately.
-    String temp_name;
-    if(!string_copy(&log_info, &temp_name) || !string_append_cstr(&temp_name, ".tmp")) {
-        string_free_resources(&log_info);
-        fclose(log_info_file);
-        return false;
-    }
+    event->format = "%s";
+    event->args = &args;
+    bool result = log_dispatch(logger, event);
 
-    FILE* temp = fopen(string_data(&temp_name), "w");
-    if(!temp) {
-        string_free_resources(&log_info);
-        string_free_resources(&temp_name);
-        fclose(log_info_file);
-        return false;
-    }
+    va_end(args);
 
-    bool found = false;
+    return result;
+}
 
-    // Loop through all lines in the file.
-    while((line_size = getLine(&line, &line_buf_size, log_info_file)) != -1) {
-        // The attribute was found. Overwrite it with the new value.
-        if(strncmp(line, attrib, attrib_length) == 0) {
-            String str = string_create(line);
-            handle_attrib(temp, &str, attrib, ctx);
+LOG_EXPORT bool mist_log_binary_replay(const char* fname, Logger* logger) {
+    FILE* file = fopen(fname, "rb");
+    if(!file)
+        return false;
 
-            found = true;
-        } else {
-            // Not the attribute. Copy it over to the temp file.
-            if(fprintf(temp, "%s\n", line) < 0) {
+    struct LogBinaryReaderSite* sites = NULL;
+    size_t site_capacity = 0;
+    struct LogArgs args = { 0 };
+    String message = string_create("");
+    uint64_t base_time = 0;
+    int version = 0;
+    bool result = true;
+    int c;
+
+    while(result && (c = getc(file)) != EOF) {
+        if(c == LOG_BINARY_MAGIC[0]) {
+            char magic[4];
+            magic[0] = (char)c;
+            if (fread(magic + 1, 1, 3, file) != 3 ||
+                memcmp(magic, LOG_BINARY_MAGIC, 4) != 0 ||
+                (version = getc(file)) < 1 ||
+                version > LOG_BINARY_VERSION ||
+                !log_binary_read_varint(file, &base_time))
+            {
                 result = false;
                 break;
             }
-        }
-    }
 
-    // If the result wasn't found, append it to the end of the file.
-    if(result && !found) {
-        if(fprintf(temp, "%s=%s\n", attrib, string_data(value)) < 0) {
-            result = false;
-        }
-    }
+            log_binary_reader_sites_clear(sites, site_capacity);
+        } else if(c == LOG_BINARY_SITE) {
+            uint64_t id, line;
+            int level;
+            if (!log_binary_read_varint(file, &id) ||
+                (level = getc(file)) == EOF || level > LOG_FATAL ||
+                !log_binary_read_varint(file, &line))
+            {
+                result = false;
+                break;
+            }
 
-    // Close the files before anything else so that they can be removed/renamed.
-    fclose(log_info_file);
-    fclose(temp);
+            if(id >= site_capacity) {
+                size_t capacity = site_capacity == 0 ? 64 : site_capacity;
+                while(capacity <= id)
+                    capacity *= 2;
 
-    // Replace the old log file with the new one if everything has been successful so far.
-    if(result)
-        result = remove(string_data(&log_info)) == 0 && rename(string_data(&temp_name), string_data(&log_info)) == 0;
+                void* buffer = realloc(sites, sizeof(*sites) * capacity);
+                if(!buffer) {
+                    result = false;
+                    break;
+                }
 
-    // free the remaining resources.
-    free(line);
-    string_free_resources(&log_info);
-    string_free_resources(&temp_name);
-    return result;
+                sites = buffer;
+                memset(sites + site_capacity, 0, sizeof(*sites) * (capacity - site_capacity));
+                site_capacity = capacity;
+            }
 
-#else
+            struct LogBinaryReaderSite* site = sites + id;
+            log_binary_reader_sites_clear(site, 1);
+            site->level = (enum LogLevel)level;
+            site->line = (uint32_t)line;
+            site->file = log_binary_read_string(file);
+            site->function = log_binary_read_string(file);
+            site->format = log_binary_read_string(file);
+            result = site->file && site->function && site->format;
+        } else if(c == LOG_BINARY_EVENT) {
+            uint64_t id, offset, size;
+            if (!log_binary_read_varint(file, &id) ||
+                !log_binary_read_varint(file, &offset) ||
+                !log_binary_read_varint(file, &size) ||
+                id >= site_capacity ||
+                !sites[id].format)
+            {
+                result = false;
+                break;
+            }
 
-    if(fseek(log_info_file, 0, SEEK_END) == 0) {
-        int64_t fsize = ftell(log_info_file);
-        if(fsize == -1) {
-            string_free_resources(&log_info);
-            fclose(log_info_file);
-            return false;
-        }
+            // Version 1 stored the time since the previous event, so its times add up.
+            uint64_t time = base_time + offset;
+            if(version == 1)
+                base_time = time;
 
-        String file_contents = string_create("");
-        if(!string_reserve(&file_contents, fsize)) {
-            string_free_resources(&log_info);
-            fclose(log_info_file);
-            return false;
-        }
+            struct LogBinaryReaderSite* site = sites + id;
 
-        if(fseek(log_info_file, 0, SEEK_SET) != 0) {
-            string_free_resources(&log_info);
-            string_free_resources(&file_contents);
-            fclose(log_info_file);
-            return false;
-        }
+            // Rebuild a full LogArgs buffer by putting the site's format in front of the arguments.
+            args.size = 0;
+            if (!log_args_append_string(&args, site->format, strlen(site->format)) ||
+                !log_args_reserve(&args, size) ||
+                fread(args.data + args.size, 1, size, file) != size)
+            {
+                result = false;
+                break;
+            }
+            args.size += size;
 
-        size_t file_read_length = fread(string_cstr(&file_contents), sizeof(char), fsize, log_info_file);
-        if(ferror(log_info_file) != 0) {
-            string_free_resources(&log_info);
-            string_free_resources(&file_contents);
-            fclose(log_info_file);
-            return false;
-        }
+            string_clear(&message);
+            if(!log_args_render(&args, &message)) {
+                result = false;
+                break;
+            }
 
-        string_cstr(&file_contents)[file_read_length] = '\0';
-        if(sso_string_is_long(&file_contents))
-            sso_string_long_set_size(&file_contents, file_read_length);
-        else
-            sso_string_short_set_size(&file_contents, file_read_length);
-
-        String new_line = string_create("\n");
-        int line_count;
-        String* lines = string_split(&file_contents, &new_line, NULL, -1, &line_count, true, true);
-        string_free_resources(&file_contents);
-        if(!lines) {
-            string_free_resources(&log_info);
-            fclose(log_info_file);
-            return false;
-        }
+            if(!mist_log_level_enabled(logger, site->level))
+                continue;
 
-        log_info_file = freopen(string_data(&log_info), "w", log_info_file);
-        if(!log_info_file) {
-            string_free_resources(&log_info);
-            return false;
+            LogEvent event;
+            log_event_init(&event, site->level, site->file, site->function, site->line, NULL, NULL);
+            event.timestamp = time;
+            log_binary_replay_event(logger, &event, string_data(&message));
+        } else {
+            result = false;
         }
+    }
 
-        bool result = true;
-        bool found = false;
+    log_binary_reader_sites_clear(sites, site_capacity);
+    free(sites);
+    log_args_free_resources(&args);
+    string_free_resources(&message);
+    fclose(file);
 
-        for(size_t i = 0; i < line_count; i++) {
-            if (result) {
-                if (string_starts_with_cstr(lines + i, attrib)) {
-                    handle_attrib(log_info_file, lines + i, attrib, ctx);
-                    found = true;
-                }
-                else {
-                    if (fprintf(log_info_file, "%s\n", string_data(lines + i)) < 0) {
-                        result = false;
-                    }
-                }
-            }
-            
-            string_free_resources(lines + i);
-        }
+    return result;
+}
 
-        if(result && !found) {
-            handle_attrib(log_info_file, NULL, attrib, ctx);
-        }
+// ======================
+// SECTION: Configuration
+// ======================
+
+// Configuration files are made of sections with "key = value" lines. Lines starting with '#' or ';' are comments.
+//
+//   [logger net.http]       The level of a logger, relative to the configured one. "[logger]" is the logger itself.
+//   level = trace           A level name, or "inherit" to use the level of the parent.
+//
+//   [target]                A target added to a logger.
+//   logger = net.http       Optional. Defaults to the configured logger.
+//   type = file             console, file or binary.
+//   layout = ${level} | ${message}
+//   min_level = debug       Optional. Defaults to trace.
+//   max_level = fatal       Optional. Defaults to fatal.
+//   file = app.log          The file name of file and binary targets.
+//   archive_size = 1048576  Optional. File targets only.
+//   max_archive_files = 5   Optional. File targets only.
+//   keep_files_open = true  Optional. File targets only.
+//   max_open_files = 32     Optional. File targets only.
+//   idle_timeout = 60000    Optional. File targets only, in milliseconds. 0 keeps idle files open.
+//   buffer_size = 65536     Optional. File targets only. 0 writes every message immediately.
+//   flush_interval = 1000   Optional. File targets only, in milliseconds.
+//   flush_level = error     Optional. File targets only.
+
+struct LogConfigEntry {
+    // The name of the logger the entry applies to, relative to the configured logger.
+    char* logger;
+
+    // The target to add to the logger, or NULL if the entry sets the logger's level.
+    LogTarget* target;
+
+    enum LogLevel level;
+    bool inherit;
+
+    // The level the logger had before the entry was applied, in case it has to be undone.
+    enum LogLevel previous_level;
+    bool previous_has_level;
+
+    // The resolved logger. Only set while the entry is being applied.
+    Logger* resolved;
+};
+
+struct LogConfig {
+    struct LogConfigEntry* entries;
+    size_t count;
+    size_t capacity;
+};
 
-        free(lines);
-        string_free_resources(&log_info);
-        fclose(log_info_file);
+/**
+ * The changes made by the last configuration that was applied, so that they can be replaced by the next one.
+ */
+struct LogConfigApplied {
+    Logger** target_loggers;
+    LogTarget** targets;
+    int target_count;
+
+    Logger** level_loggers;
+    enum LogLevel* levels;
+    int level_count;
+};
 
-        return result;
+// The keys of a target section that are collected until the section ends.
+struct LogConfigTargetSection {
+    char* logger;
+    char* type;
+    char* layout;
+    char* file;
+    enum LogLevel min_level;
+    enum LogLevel max_level;
+    size_t archive_size;
+    int max_archive_files;
+    bool keep_files_open;
+    size_t max_open_files;
+    uint32_t idle_timeout;
+    size_t buffer_size;
+    uint32_t flush_interval;
+    enum LogLevel flush_level;
+};
+
+static void log_config_free_resources(struct LogConfig* config) {
+    for(size_t i = 0; i < config->count; i++) {
+        free(config->entries[i].logger);
+        if(config->entries[i].target)
+            log_target_free(config->entries[i].target);
     }
 
-    return false;
-#endif
+    free(config->entries);
+    config->entries = NULL;
+    config->count = 0;
+    config->capacity = 0;
 }
 
-static void log_file_info_write_attribute_impl(FILE* file, String* current_line, char* attrib, void* ctx) {
-    String* str = ctx;
-    fprintf(file, "%s=%s\n", attrib, string_data(str));
+static void log_config_applied_free_resources(struct LogConfigApplied* applied) {
+    free(applied->target_loggers);
+    free(applied->targets);
+    free(applied->level_loggers);
+    free(applied->levels);
+    memset(applied, 0, sizeof(*applied));
 }
 
-static void log_file_info_append_attribute_impl(FILE* file, String* current_line, char* attrib, void* ctx) {
-    String* str = ctx;
-    if(current_line)
-        fprintf(file, "%s%s\n", string_data(current_line), string_data(str));
-    else
-        fprintf(file, "%s=%s\n", attrib, string_data(str));
-}
+static void log_config_applied_free(struct LogConfigApplied* applied) {
+    if(!applied)
+        return;
 
-static bool log_file_info_write_attribute(struct LogFile* file, char* attrib, String* value) {
-    return log_file_info_handle_attribute(file, attrib, value, log_file_info_write_attribute_impl);
+    log_config_applied_free_resources(applied);
+    free(applied);
 }
 
-static bool log_file_info_append_attribute(struct LogFile* file, char* attrib, String* value) {
-    return log_file_info_handle_attribute(file, attrib, value, log_file_info_append_attribute_impl);
+static bool log_logger_in_tree(Logger* logger, Logger* tree) {
+    for(; logger; logger = logger->parent) {
+        if(logger == tree)
+            return true;
+    }
+
+    return false;
 }
 
-#ifdef LOG_WINDOWS
+// Drops the changes made to the loggers of a tree that is about to be freed, which frees their targets itself.
+static void log_config_applied_forget(struct LogConfigApplied* applied, Logger* tree) {
+    int count = 0;
+    for(int i = 0; i < applied->target_count; i++) {
+        if(log_logger_in_tree(applied->target_loggers[i], tree))
+            continue;
 
-static time_t log_file_time_to_time(FILETIME* ft) {
-    ULARGE_INTEGER ull; 
-    ull.LowPart = ft->dwLowDateTime;
-    ull.HighPart = ft->dwHighDateTime;
-    return ull.QuadPart / 10000000ULL - 11644473600ULL;
+        applied->target_loggers[count] = applied->target_loggers[i];
+        applied->targets[count++] = applied->targets[i];
+    }
+    applied->target_count = count;
+
+    count = 0;
+    for(int i = 0; i < applied->level_count; i++) {
+        if(log_logger_in_tree(applied->level_loggers[i], tree))
+            continue;
+
+        applied->level_loggers[count] = applied->level_loggers[i];
+        applied->levels[count++] = applied->levels[i];
+    }
+    applied->level_count = count;
 }
 
-#endif
+static char* log_config_trim(char* text) {
+    while(*text == ' ' || *text == '\t')
+        text++;
 
-static void log_file_creation_time(struct LogFile* file) {
-#if defined(LOG_WINDOWS)
+    size_t length = strlen(text);
+    while(length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t' || text[length - 1] == '\r'))
+        text[--length] = '\0';
 
-    WIN32_FILE_ATTRIBUTE_DATA file_data;
-    if(GetFileAttributesExA(string_data(&file->name), GetFileExInfoStandard, &file_data)) {
-        time_t t = log_file_time_to_time(&file_data.ftCreationTime);
-        file->creation_time = *localtime(&t);
-        return;
-    }
+    return text;
+}
 
-#elif defined(LOG_GCC) && defined(LOG_STATX)
+static bool log_config_parse_level(const char* text, enum LogLevel* level) {
+    for(size_t i = 0; i < sizeof(log_level_names) / sizeof(*log_level_names); i++) {
+        size_t j = 0;
+        while(text[j] && tolower((unsigned char)text[j]) == tolower((unsigned char)log_level_names[i].text[j]))
+            j++;
 
-    struct statx buffer;
-    if(statx(AT_FDCWD, string_data(&file->fname), AT_STATX_SYNC_AS_STAT, STATX_BTIME, &buffer) == 0) {
-        time_t t = buffer.stx_btime.tv_sec;
-        file->creation_time = *localtime(&t);
-        return;
+        if(j == log_level_names[i].length && text[j] == '\0') {
+            *level = (enum LogLevel)i;
+            return true;
+        }
     }
 
-#endif
+    return false;
+}
 
-    String create_time = string_create("");
-    if(log_file_info_attribute(file, "creation_time", &create_time)) {
-        time_t t;
-        if(sscanf(string_data(&create_time), "%lld", &t) == 1) {
-            file->creation_time = *localtime(&t);
-        }
+static bool log_config_add_entry(struct LogConfig* config, const char* logger, LogTarget* target, enum LogLevel level, bool inherit) {
+    if(config->count == config->capacity) {
+        size_t capacity = config->capacity == 0 ? 4 : config->capacity * 2;
+        void* buffer = realloc(config->entries, sizeof(*config->entries) * capacity);
+        if(!buffer)
+            return false;
 
-        string_free_resources(&create_time);
+        config->entries = buffer;
+        config->capacity = capacity;
     }
+
+    size_t length = logger ? strlen(logger) : 0;
+    char* name = malloc(length + 1);
+    if(!name)
+        return false;
+
+    memcpy(name, logger ? logger : "", length + 1);
+
+    struct LogConfigEntry* entry = config->entries + config->count++;
+    memset(entry, 0, sizeof(*entry));
+    entry->logger = name;
+    entry->target = target;
+    entry->level = level;
+    entry->inherit = inherit;
+
+    return true;
 }
 
-static void log_file_sequence(struct LogFile* file) {
-    String sequence = string_create("");
-    if(log_file_info_attribute(file, "sequence", &sequence)) {
-        int sequence_num;
-        
-        if(sscanf(string_data(&sequence), "%d", &sequence_num) == 1) {
-            file->sequence = sequence_num + 1;
-        }
-        string_free_resources(&sequence);
-        return;
-    }
+static bool log_config_end_target(struct LogConfig* config, struct LogConfigTargetSection* section) {
+    if(!section->type)
+        return false;
+
+    LogTarget* target = NULL;
+    if(strcmp(section->type, "console") == 0) {
+        if(!section->layout)
+            return false;
+
+        target = log_target_console_create(section->layout, section->min_level, section->max_level);
+    } else if(strcmp(section->type, "file") == 0) {
+        if(!section->layout || !section->file)
+            return false;
+
+        struct LogFileTargetContext* ctx = log_file_target_context_create(section->file);
+        if(!ctx)
+            return false;
+
+        if(section->archive_size)
+            log_file_target_context_archive_on_size(ctx, section->archive_size);
 
-    file->sequence = 1;
-}
+        if(section->max_archive_files)
+            log_file_target_context_set_max_archive_files(ctx, section->max_archive_files);
 
-static uint64_t log_file_size(struct LogFile* file) {
-#if defined(LOG_WINDOWS)
+        log_file_target_context_set_max_open_files(ctx, section->max_open_files);
+        log_file_target_context_set_idle_timeout(ctx, section->idle_timeout);
+        if(section->keep_files_open)
+            log_file_target_context_keep_files_open(ctx);
 
-    uint64_t size = GetFileSize(file->file, NULL);
-    if(size == INVALID_FILE_SIZE)
-        return 0;
+        log_file_target_context_set_buffering(ctx, section->buffer_size, section->buffer_size == 0 ? _IONBF : _IOFBF);
+        log_file_target_context_set_flush_interval(ctx, section->flush_interval);
+        log_file_target_context_set_flush_level(ctx, section->flush_level);
 
-    return size;
+        target = log_target_file_create(section->layout, section->min_level, section->max_level, ctx);
+        if(!target)
+            log_file_target_context_free(ctx);
+    } else if(strcmp(section->type, "binary") == 0) {
+        if(!section->file)
+            return false;
 
-#elif defined(LOG_GCC) && defined(LOG_STATX)
-    struct statx buffer;
-    if(statx(AT_FDCWD, string_data(&file->fname), AT_STATX_SYNC_AS_STAT, STATX_SIZE, &buffer) == 0) {
-        return buffer.stx_size;
+        target = log_target_binary_create(section->file, section->min_level, section->max_level);
     }
-#else
 
-    fseek(file->file, 0, SEEK_END);
-    size_t size = ftell(file->file);
-    fseek(file->file, 0, SEEK_SET);
+    if(!target)
+        return false;
 
-    return size;
+    if(!log_config_add_entry(config, section->logger, target, LOG_TRACE, false)) {
+        log_target_free(target);
+        return false;
+    }
 
-#endif
+    return true;
 }
 
-static struct LogFile* log_file_open(struct LogFileTargetContext* ctx, String* fname) {
-    for(int i = 0; i < ctx->files_count; i++) {
-        if(string_equals_string(&ctx->files[i].name, fname)) {
-            if(!ctx->keep_files_open) {
-                ctx->files[i].file = fopen(string_data(fname), "a");
-                if(!ctx->files[i].file)
-                    return NULL;
-            }
+static void log_config_begin_target(struct LogConfigTargetSection* section) {
+    memset(section, 0, sizeof(*section));
+    section->min_level = LOG_TRACE;
+    section->max_level = LOG_FATAL;
+    section->max_open_files = LOG_FILE_MAX_OPEN_FILES;
+    section->buffer_size = LOG_FILE_BUFFER_SIZE;
+    section->flush_interval = LOG_FILE_FLUSH_INTERVAL;
+    section->flush_level = LOG_ERROR;
+}
 
-            return ctx->files + i;
+/**
+ * Parses a configuration file, creating the targets it describes. The text is modified in place.
+ */
+static bool log_config_parse(char* text, struct LogConfig* config) {
+    enum { LOG_CONFIG_NONE, LOG_CONFIG_LOGGER, LOG_CONFIG_TARGET } kind = LOG_CONFIG_NONE;
+    char* logger = NULL;
+    struct LogConfigTargetSection target;
+    log_config_begin_target(&target);
+
+    char* line = text;
+    while(line) {
+        char* next = strchr(line, '\n');
+        if(next)
+            *next++ = '\0';
+
+        line = log_config_trim(line);
+        if(*line == '\0' || *line == '#' || *line == ';') {
+            line = next;
+            continue;
         }
-    }
 
-    if(ctx->files_count == ctx->files_capacity) {
-        size_t capacity = ctx->files_capacity == 0 ? 2 : ctx->files_capacity * 2;
-        void* buffer = realloc(ctx->files, sizeof(*ctx->files) * capacity);
-        if(!buffer)
-            return NULL;
-        
-        ctx->files = buffer;
-        ctx->files_capacity = capacity;
-    }
+        if(*line == '[') {
+            char* end = strchr(line, ']');
+            if(!end)
+                goto error;
 
-    struct LogFile* file = ctx->files + ctx->files_count++;
+            *end = '\0';
+            if(kind == LOG_CONFIG_TARGET && !log_config_end_target(config, &target))
+                goto error;
 
-    if(log_file_exists(fname)) {
-        file->file = fopen(string_data(fname), "a");
-        if(!file->file)
-            return NULL;
+            char* header = log_config_trim(line + 1);
+            size_t length = strcspn(header, " \t");
+            char* name = log_config_trim(header + length);
 
-        string_copy(fname, &file->name);
+            if(length == 6 && strncmp(header, "logger", 6) == 0) {
+                kind = LOG_CONFIG_LOGGER;
+                logger = name;
+            } else if(length == 6 && strncmp(header, "target", 6) == 0) {
+                kind = LOG_CONFIG_TARGET;
+                log_config_begin_target(&target);
+            } else {
+                goto error;
+            }
 
-        if(ctx->archive_timing != FILE_ARCHIVE_NONE && ctx->archive_timing != FILE_ARCHIVE_SIZE) {
-            log_file_creation_time(file);
+            line = next;
+            continue;
         }
 
-        if(ctx->archive_numbering == FILE_ARCHIVE_NUMBER_SEQUENCE) {
-            log_file_sequence(file);
-        }
-    } else {
-        file->file = fopen(string_data(fname), "a");
-        if(!file->file)
-            return NULL;
+        char* value = strchr(line, '=');
+        if(!value)
+            goto error;
 
-        string_copy(fname, &file->name);
-        if(ctx->archive_timing != FILE_ARCHIVE_NONE && ctx->archive_timing != FILE_ARCHIVE_SIZE) {
-            time_t t = time(NULL);
-            file->creation_time = *localtime(&t);
-        }
+        *value++ = '\0';
+        char* key = log_config_trim(line);
+        value = log_config_trim(value);
+
+        if(kind == LOG_CONFIG_LOGGER && strcmp(key, "level") == 0) {
+            enum LogLevel level = LOG_TRACE;
+            bool inherit = strcmp(value, "inherit") == 0;
+            if(!inherit && !log_config_parse_level(value, &level))
+                goto error;
 
-        if(ctx->archive_numbering == FILE_ARCHIVE_NUMBER_SEQUENCE) {
-            log_file_sequence(file);
+            if(!log_config_add_entry(config, logger, NULL, level, inherit))
+                goto error;
+        } else if(kind == LOG_CONFIG_TARGET) {
+            if(strcmp(key, "logger") == 0)
+                target.logger = value;
+            else if(strcmp(key, "type") == 0)
+                target.type = value;
+            else if(strcmp(key, "layout") == 0)
+                target.layout = value;
+            else if(strcmp(key, "file") == 0)
+                target.file = value;
+            else if(strcmp(key, "min_level") == 0) {
+                if(!log_config_parse_level(value, &target.min_level))
+                    goto error;
+            } else if(strcmp(key, "max_level") == 0) {
+                if(!log_config_parse_level(value, &target.max_level))
+                    goto error;
+            } else if(strcmp(key, "archive_size") == 0)
+                target.archive_size = (size_t)strtoull(value, NULL, 10);
+            else if(strcmp(key, "max_archive_files") == 0)
+                target.max_archive_files = atoi(value);
+            else if(strcmp(key, "keep_files_open") == 0)
+                target.keep_files_open = strcmp(value, "true") == 0;
+            else if(strcmp(key, "max_open_files") == 0)
+                target.max_open_files = (size_t)strtoull(value, NULL, 10);
+            else if(strcmp(key, "idle_timeout") == 0)
+                target.idle_timeout = (uint32_t)strtoul(value, NULL, 10);
+            else if(strcmp(key, "buffer_size") == 0)
+                target.buffer_size = (size_t)strtoull(value, NULL, 10);
+            else if(strcmp(key, "flush_interval") == 0)
+                target.flush_interval = (uint32_t)strtoul(value, NULL, 10);
+            else if(strcmp(key, "flush_level") == 0) {
+                if(!log_config_parse_level(value, &target.flush_level))
+                    goto error;
+            }
+            else
+                goto error;
+        } else {
+            goto error;
         }
+
+        line = next;
     }
 
-    return file;
-}
+    if(kind == LOG_CONFIG_TARGET && !log_config_end_target(config, &target))
+        goto error;
 
-static bool string_strip_extension(String* value, String* ext) {
-    size_t position = string_rfind_cstr(value, 0, ".");
-    if(position == SIZE_MAX)
+    return true;
+
+    error:
+        log_config_free_resources(config);
         return false;
+}
 
-    if(!string_append_string_part(ext, value, position, string_size(value) - position))
+static bool log_config_read(const char* fname, struct LogConfig* config) {
+    FILE* file = fopen(fname, "rb");
+    if(!file)
         return false;
 
-    string_erase(value, position, string_size(value) - position);
-    return true;
-}
+    char* text = NULL;
+    long size;
+    if(fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0)
+        goto error;
 
-struct LogArchiveDeleteContext {
-    // Borrowed pointer to the new file name.
-    String* new_file;
+    text = malloc((size_t)size + 1);
+    if(!text || fread(text, 1, (size_t)size, file) != (size_t)size)
+        goto error;
 
-    // Either max_archive_days or max_archive_files.
-    int value;
-};
+    text[size] = '\0';
+    fclose(file);
 
-static void log_info_delete_files_on_days_impl(FILE* file, String* current_line, char* attrib, void* ptr) {
-    struct LogArchiveDeleteContext* ctx = ptr;
-    time_t current_time = time(NULL);
+    bool result = log_config_parse(text, config);
+    free(text);
+    return result;
 
-    if(!current_line) {
-        fprintf(file, "%s=%lld?%s\n", attrib, (int64_t)current_time, string_data(ctx->new_file));
-        return;
+    error:
+        free(text);
+        fclose(file);
+        return false;
+}
+
+static void log_targets_remove(Logger* logger, LogTarget* target) {
+    for(int i = 0; i < logger->target_count; i++) {
+        if(logger->targets[i] == target) {
+            memmove(logger->targets + i, logger->targets + i + 1, sizeof(*logger->targets) * (logger->target_count - i - 1));
+            logger->target_count--;
+            return;
+        }
     }
+}
 
-    size_t attrib_length = strlen(attrib) + 1;
-    String value = string_create("");
-    String fname = string_create("");
-    String* files = NULL;
-    bool processing = false;
+/**
+ * Replaces the changes of the previously applied configuration with a new one, publishing the result with a single
+ * update of the logger's snapshots. Either all of the new configuration is applied, or none of it.
+ */
+static bool log_config_apply(Logger* logger, struct LogConfig* config, struct LogConfigApplied* applied) {
+    struct LogConfigApplied next = { 0 };
+    LogTarget** removed = NULL;
+    size_t added = 0;
+    size_t leveled = 0;
+
+    int target_count = 0;
+    int level_count = 0;
+    for(size_t i = 0; i < config->count; i++) {
+        if(config->entries[i].target)
+            target_count++;
+        else if(!config->entries[i].inherit)
+            level_count++;
+    }
 
-    if(!string_append_string_part(&value, current_line, attrib_length, string_size(current_line) - attrib_length))
-        goto end;
+    next.target_loggers = malloc(sizeof(*next.target_loggers) * (target_count + 1));
+    next.targets = malloc(sizeof(*next.targets) * (target_count + 1));
+    next.level_loggers = malloc(sizeof(*next.level_loggers) * (level_count + 1));
+    next.levels = malloc(sizeof(*next.levels) * (level_count + 1));
+    if(!next.target_loggers || !next.targets || !next.level_loggers || !next.levels)
+        goto error;
 
-    String separator = string_create("|");
-    int count;
-    files = string_split(&value, &separator, NULL, STRING_SPLIT_ALLOCATE, &count, true, true);
-    if(!files)
-        goto end;
+    // The previous changes are only read and replaced under the lock, since a logger's configuration can be loaded
+    // from several threads.
+    log_spin_lock(&log_config_lock);
 
-    string_clear(&value);
+    removed = malloc(sizeof(*removed) * (applied->target_count + 1));
+    if(!removed)
+        goto error_locked;
 
-    processing = true;
+    for(size_t i = 0; i < config->count; i++) {
+        config->entries[i].resolved = log_logger_get_child_locked(logger, config->entries[i].logger);
+        if(!config->entries[i].resolved)
+            goto error_locked;
+    }
 
-    for(size_t i = 0; i < count; i++) {
-        if(processing) {
-            string_clear(&fname);
-            int64_t arg;
-            size_t index = string_find_cstr(files + i, 0, "?");
-            if(index != SIZE_MAX) {
-                if(string_append_string_part(&fname, files + i, 0, index)) {
-                    if(sscanf(string_data(files + i) + index + 1, "%lld", &arg) == 1) {
-                        time_t t = arg;
-                        double diff = difftime(current_time, t);
-                        if(diff >= 86400 * ctx->value)
-                            remove(string_data(&fname));
-                        else {
-                            processing = string_append_string(&value, files + i) && string_append_cstr(&value, "|");
-                        }
-                    } else {
-                        processing = false;
-                    }
-                } else {
-                    processing = false;
-                }
-            }
-        }
+    // Adding the new targets is the only step that can fail, so it's done before anything else is changed.
+    for(added = 0; added < config->count; added++) {
+        struct LogConfigEntry* entry = config->entries + added;
+        if(entry->target && !log_targets_insert(&entry->resolved->targets, &entry->resolved->target_count, &entry->resolved->target_capacity, entry->target))
+            goto error_locked;
+    }
 
-        string_free_resources(files + i);
+    for(int i = 0; i < applied->target_count; i++) {
+        log_targets_remove(applied->target_loggers[i], applied->targets[i]);
+        removed[i] = applied->targets[i];
     }
 
-    end:
-        if(processing)
-            fprintf(file, "%s\n", string_data(&value));
-        else
-            fprintf(file, "%s\n", string_data(current_line));
+    for(int i = 0; i < applied->level_count; i++)
+        applied->level_loggers[i]->has_level = false;
 
-        string_free_resources(&fname);
-        string_free_resources(&value);
-        free(files);
-}
+    for(leveled = 0; leveled < config->count; leveled++) {
+        struct LogConfigEntry* entry = config->entries + leveled;
+        if(entry->target)
+            continue;
 
-static void log_info_delete_files_on_count_impl(FILE* file, String* current_line, char* attrib, void* ptr) {
-    struct LogArchiveDeleteContext* ctx = ptr;
-    if(!current_line) {
-        fprintf(file, "%s=%s\n", attrib, string_data(ctx->new_file));
-        return;
+        entry->previous_has_level = entry->resolved->has_level;
+        entry->previous_level = entry->resolved->level;
+        entry->resolved->has_level = !entry->inherit;
+        entry->resolved->level = entry->level;
     }
 
-    size_t attrib_length = strlen(attrib) + 1;
-    String value = string_create("");
-    String fname = string_create("");
-    String* files = NULL;
-    bool processing = false;
+    if(!log_logger_update(logger, removed, applied->target_count))
+        goto error_restore;
 
-    if(!string_append_string_part(&value, current_line, attrib_length, string_size(current_line) - attrib_length))
-        goto end;
-
-    String separator = string_create("|");
-    int count;
-    files = string_split(&value, &separator, NULL, STRING_SPLIT_ALLOCATE, &count, true, true);
-    if(!files)
-        goto end;
+    for(size_t i = 0; i < config->count; i++) {
+        struct LogConfigEntry* entry = config->entries + i;
+        if(entry->target) {
+            next.target_loggers[next.target_count] = entry->resolved;
+            next.targets[next.target_count++] = entry->target;
 
-    string_clear(&value);
-    processing = true;
-    int i = 0;
-    int files_to_delete = count - ctx->value + 1;
-
-    for(; i < files_to_delete; i++) {
-        remove(string_data(files + i));
-        string_free_resources(files + i);
-    }
-
-    string_clear(&value);
-    for(; i < count; i++) {
-        if(processing) {
-            processing = string_append_string(&value, files + i);
-            if (processing) {
-                if(string_get(&value, string_size(&value) - 1) == '\n')
-                    string_resize(&value, string_size(&value) - 1, ' ');
-                    
-                processing = string_append_cstr(&value, "|");
-            }
+            // The target belongs to its logger now.
+            entry->target = NULL;
+        } else if(!entry->inherit) {
+            next.level_loggers[next.level_count] = entry->resolved;
+            next.levels[next.level_count++] = entry->level;
         }
-        string_free_resources(files + i);
     }
 
-    if (processing)
-        processing = string_append_string(&value, ctx->new_file);
-
-    end:
-        if(processing)
-            fprintf(file, "%s=%s\n", attrib, string_data(&value));
-        else
-            fprintf(file, "%s\n", string_data(current_line));
-        string_free_resources(&fname);
-        string_free_resources(&value);
-        free(files);
-}
+    struct LogConfigApplied previous = *applied;
+    *applied = next;
 
-static bool log_info_delete_files_on_days(struct LogFile* file, struct LogArchiveDeleteContext* ctx) {
-    return log_file_info_handle_attribute(file, "archives", ctx, log_info_delete_files_on_days_impl);
-}
+    log_spin_unlock(&log_config_lock);
 
-static bool log_info_delete_files_on_count(struct LogFile* file, struct LogArchiveDeleteContext* ctx) {
-    return log_file_info_handle_attribute(file, "archives", ctx, log_info_delete_files_on_count_impl);
-}
+    log_config_applied_free_resources(&previous);
+    return true;
 
-static void log_file_delete_old_archives(
-    struct LogFileTargetContext* ctx, 
-    struct LogFile* file,
-    String* log_archive_name,
-    String* archive_file_pattern,
-    time_t t)
-{
-    if(ctx->max_archive_days > 0) {
-#if defined(LOG_WINDOWS)
-        WIN32_FIND_DATAA find_data;
-        HANDLE handle = FindFirstFileA(string_data(archive_file_pattern), &find_data);
-        if(handle != INVALID_HANDLE_VALUE) {
-            do {
-                time_t archive_time = log_file_time_to_time(&find_data.ftCreationTime);
-                double time_diff = difftime(t, archive_time);
-                if(time_diff >= 86400 * ctx->max_archive_days)
-                    DeleteFileA(find_data.cFileName);
+    error_restore:
+        while(leveled > 0) {
+            struct LogConfigEntry* entry = config->entries + --leveled;
+            if(!entry->target) {
+                entry->resolved->has_level = entry->previous_has_level;
+                entry->resolved->level = entry->previous_level;
             }
-            while(FindNextFileA(handle, &find_data));
+        }
 
-            FindClose(handle);
-            return;
+        for(int i = 0; i < applied->level_count; i++) {
+            applied->level_loggers[i]->has_level = true;
+            applied->level_loggers[i]->level = applied->levels[i];
         }
-#elif defined(LOG_STATX)
-        glob_t pattern;
-        struct statx buffer;
-        if(glob(string_data(&archive_file_pattern), 0, NULL, &pattern) == 0) {
-            for(int i = 0; i < pattern.gl_pathc; i++) {
-                if(statx(AT_FDCWD, pattern.gl_pathv[i], AT_STATX_SYNC_AS_STAT, STATX_BTIME, &buffer) == 0) {
-                    double time_diff = difftime(t, (time_t)buffer.stx_btime.tv_sec);
-                    if(time_diff >= 86400 * ctx->max_archive_days)
-                        remove(pattern.gl_pathv[i]);
-                }
-            }
-            globfree(&pattern);
-            return;
+
+        // Removing targets never shrinks the arrays, so putting them back can't fail.
+        for(int i = 0; i < applied->target_count; i++) {
+            Logger* owner = applied->target_loggers[i];
+            log_targets_insert(&owner->targets, &owner->target_count, &owner->target_capacity, applied->targets[i]);
         }
-        globfree(&pattern);
-#endif
-        struct LogArchiveDeleteContext delete_ctx;
-        delete_ctx.value = ctx->max_archive_days;
-        delete_ctx.new_file = log_archive_name;
-        log_info_delete_files_on_days(file, &delete_ctx);
-    } else if(ctx->max_archive_files > 0) {
-        // Todo: Optimize this using FindNextFile/glob.
-        struct LogArchiveDeleteContext delete_ctx;
-        delete_ctx.value = ctx->max_archive_files;
-        delete_ctx.new_file = log_archive_name;
-        log_info_delete_files_on_count(file, &delete_ctx);
-    }
-}
-
-static void log_file_archive_impl(
-    struct LogFileTargetContext* ctx, 
-    struct LogFile* file,
-    enum LogLevel log_level,
-    const char* calling_file,
-    const char* function,
-    uint32_t line,
-    ...)
-{
-    String log_file_name = string_create("");
 
-    va_list list;
-    va_start(list, line);
-    if(!mist_log_format(ctx->archive_file_name, log_level, calling_file, function, line, &log_file_name, "%s", list))
-        return;
-    va_end(list);
+    error_locked:
+        while(added > 0) {
+            struct LogConfigEntry* entry = config->entries + --added;
+            if(entry->target)
+                log_targets_remove(entry->resolved, entry->target);
+        }
 
-    String ext = string_create("");
-    String archive_file_pattern = string_create("");
-    String number = string_create("");
-    String log_files = string_create("");
-    bool has_ext = false;
-    time_t t = time(NULL);
-    bool result = false;
+        log_spin_unlock(&log_config_lock);
 
-    switch(ctx->archive_numbering) {
-        case FILE_ARCHIVE_NUMBER_NONE:
-            remove(string_data(&log_file_name));
-            result = true;
-            break;
-        case FILE_ARCHIVE_NUMBER_SEQUENCE:
-            has_ext = string_strip_extension(&log_file_name, &ext);
+    error:
+        free(removed);
+        log_config_applied_free_resources(&next);
+        return false;
+}
 
-            if (!string_append_string(&archive_file_pattern, &log_file_name) ||
-                !string_append_cstr(&archive_file_pattern, "*"))
-            {
-                break;
-            } else if(has_ext && !string_append_string(&archive_file_pattern, &ext)) {
-                break;
-            }
-            
-            if(!string_format_cstr(&number, "%d", file->sequence))
-                break;
+LOG_EXPORT bool log_logger_load_config(Logger* logger, const char* fname) {
+    if(!logger || !fname)
+        return false;
 
-            if(!string_format_cstr(&log_file_name, ".%s", string_data(&number)))
-                break;
-            
-            if(has_ext && !string_append_string(&log_file_name, &ext))
-                break;
+    struct LogConfig config = { 0 };
+    if(!log_config_read(fname, &config))
+        return false;
 
-            log_file_info_write_attribute(file, "sequence", &number);
-            result = true;
-            break;
-        case FILE_ARCHIVE_NUMBER_DATE:
-            char datetime[256];
-            struct tm time_value = *localtime(&t);
-            size_t count = strftime(datetime, 256, string_data(&ctx->archive_date_format), &time_value);
-            if(count == 0)
-                break;
+    bool result = false;
 
-            has_ext = string_strip_extension(&log_file_name, &ext);
-            if( !string_append_cstr(&log_file_name, ".") || 
-                !string_append_cstr_part(&log_file_name, datetime, 0, count)) 
-            {
-                break;
-            }
+    // The logger keeps what was applied, so that loading a configuration again replaces it instead of adding to it.
+    log_spin_lock(&log_config_lock);
+    if(!logger->config)
+        logger->config = calloc(1, sizeof(*logger->config));
 
-            if(has_ext && !string_append_string(&log_file_name, &ext))
-                break;
+    struct LogConfigApplied* applied = logger->config;
+    log_spin_unlock(&log_config_lock);
 
-            result = true;
-            break;
-    }
+    if(applied)
+        result = log_config_apply(logger, &config, applied);
 
-    if(result) {
-        bool was_open = file->file != NULL;
-        if(was_open)
-            fclose(file->file);
+    log_config_free_resources(&config);
+    return result;
+}
 
-        int rename_result = rename(string_data(&file->name), string_data(&log_file_name));
-        if (rename_result < 0) {
-            char* error = strerror(errno);
-            printf("Failed to rename file: %s", error);
-        }
+#if defined(__linux__) && defined(LOG_THREADS)
 
-        if(was_open) {
-            file->file = fopen(string_data(&file->name), "w+");
-            if(!file->file)
-                goto end;
-        }
+struct LogConfigWatcher {
+    Logger* logger;
+    char* fname;
 
-        if(ctx->archive_numbering == FILE_ARCHIVE_NUMBER_SEQUENCE)
-            file->sequence++;
+    // The file name without its directory, which is compared against the names of changed files.
+    const char* name;
 
-        if(ctx->archive_timing != FILE_ARCHIVE_NONE && ctx->archive_timing != FILE_ARCHIVE_SIZE)
-            file->creation_time = *localtime(&t);
+    struct LogConfigApplied applied;
 
-        if(ctx->archive_numbering != FILE_ARCHIVE_NUMBER_NONE)
-            log_file_delete_old_archives(ctx, file, &log_file_name, &archive_file_pattern, t);
-    }
+    int fd;
+    LogThread thread;
+    volatile size_t running;
+};
 
-    end:
-        string_free_resources(&log_file_name);
-        string_free_resources(&ext);
-        string_free_resources(&number);
-        string_free_resources(&archive_file_pattern);
-}
+static void log_config_watcher_reload(struct LogConfigWatcher* watcher) {
+    struct LogConfig config = { 0 };
 
-static void log_file_archive(
-    struct LogFileTargetContext* ctx, 
-    struct LogFile* file,
-    enum LogLevel log_level,
-    const char* calling_file,
-    const char* function,
-    uint32_t line,
-    String* msg)
-{
-    log_file_archive_impl(ctx, file, log_level, calling_file, function, line, string_data(msg));
+    // A file that can't be read or parsed (e.g. while it's being written) leaves the current configuration in place.
+    if(log_config_read(watcher->fname, &config))
+        log_config_apply(watcher->logger, &config, &watcher->applied);
+
+    log_config_free_resources(&config);
 }
 
-static bool log_file_day_passed(struct tm* creation_time, struct tm* current_time, int day) {
-    int last_day = creation_time->tm_yday - creation_time->tm_wday + day;
+static void log_config_watcher_run(void* arg) {
+    struct LogConfigWatcher* watcher = arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
 
-    // Make sure to account for leap year.
-    int max_days = 365;
-    if(creation_time->tm_year % 4 == 0) {
-        if(creation_time->tm_year % 100 == 0) {
-            if(creation_time->tm_year % 400 != 0) {
-                max_days = 366;
-            }
-        } else {
-            max_days = 366;
+    while(log_atomic_load_size(&watcher->running)) {
+        struct pollfd poll_fd = { .fd = watcher->fd, .events = POLLIN };
+        if(poll(&poll_fd, 1, 100) <= 0)
+            continue;
+
+        ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+        if(length <= 0)
+            continue;
+
+        // The directory is watched so that files replaced by a rename are noticed as well.
+        bool changed = false;
+        for(char* ptr = buffer; ptr < buffer + length; ) {
+            struct inotify_event* event = (struct inotify_event*)ptr;
+            if(event->len && strcmp(event->name, watcher->name) == 0)
+                changed = true;
+
+            ptr += sizeof(*event) + event->len;
         }
-    }
 
-    if(last_day >= max_days - 7) {
-        return current_time->tm_yday >= (7 - (max_days - last_day));
-    } else if(current_time->tm_year > creation_time->tm_year) {
-        return current_time->tm_yday >= last_day + 7;
+        if(changed)
+            log_config_watcher_reload(watcher);
     }
-
-    return false;
 }
 
-static void log_file_archive_if_needed(
-    struct LogFileTargetContext* ctx, 
-    struct LogFile* file,
-    enum LogLevel log_level,
-    const char* calling_file,
-    const char* function,
-    uint32_t line,
-    String* msg) 
-{
-    if(ctx->archive_timing == FILE_ARCHIVE_NONE)
-        return;
+LOG_EXPORT struct LogConfigWatcher* log_logger_watch_config(Logger* logger, const char* fname) {
+    if(!logger || !fname)
+        return NULL;
 
-    if(ctx->archive_timing == FILE_ARCHIVE_SIZE) {
-        size_t fsize = log_file_size(file);
-        if(fsize >= ctx->archive_above_size) {
+    struct LogConfigWatcher* watcher = calloc(1, sizeof(*watcher));
+    if(!watcher)
+        return NULL;
 
-        }
-    } else {
-        time_t current_time = time(NULL);
-        struct tm* datetime = localtime(&current_time);
-        time_t file_time;
-        double difference;
-        switch(ctx->archive_timing) {
-            case FILE_ARCHIVE_DAY:
-                file_time = mktime(&file->creation_time);
-                difference = difftime(current_time, file_time);
-                if(difference >= 86400)
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_HOUR:
-                file_time = mktime(&file->creation_time);
-                difference = difftime(current_time, file_time);
-                if(difference >= 3600)
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_MINUTE:
-                file_time = mktime(&file->creation_time);
-                difference = difftime(current_time, file_time);
-                if(difference >= 60)
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_MONTH:
-                if (datetime->tm_mon > file->creation_time.tm_mon ||
-                    datetime->tm_year > file->creation_time.tm_year)
-                    {
-                        log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                    }
-                    break;
-            case FILE_ARCHIVE_YEAR:
-                if(datetime->tm_year > file->creation_time.tm_year)
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_SUNDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 0))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_MONDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 1))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_TUESDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 2))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_WEDNESDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 3))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_THURSDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 4))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_FRIDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 5))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-            case FILE_ARCHIVE_SATURDAY:
-                if(log_file_day_passed(&file->creation_time, datetime, 6))
-                    log_file_archive(ctx, file, log_level, calling_file, function, line, msg);
-                break;
-        }
-    }
-}
+    watcher->logger = logger;
+    watcher->fd = -1;
 
-static void log_file_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ptr) {
-    struct LogFileTargetContext* ctx = ptr;
-    String fname = string_create("");
+    size_t length = strlen(fname);
+    watcher->fname = malloc(length + 1);
+    if(!watcher->fname)
+        goto error;
 
-    if(!mist_log_format(ctx->file_name, log_level, file, function, line, &fname, "%s", string_data(msg)))
-        return;
+    memcpy(watcher->fname, fname, length + 1);
 
-    struct LogFile* log_file = log_file_open(ctx, &fname);
-    if(!log_file) {
-        string_free_resources(&fname);
-        return;
-    }
+    char* slash = strrchr(watcher->fname, '/');
+    watcher->name = slash ? slash + 1 : watcher->fname;
 
-    fprintf(log_file->file, "%s\n", string_data(msg));
+    struct LogConfig config = { 0 };
+    if(!log_config_read(fname, &config))
+        goto error;
 
+    bool applied = log_config_apply(logger, &config, &watcher->applied);
+    log_config_free_resources(&config);
+    if(!applied)
+        goto error;
 
-    if (!ctx->keep_files_open) {
-        fclose(log_file->file);
-        log_file->file = NULL;
-    }
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watcher->fd == -1)
+        goto error;
 
-    log_file_archive_if_needed(ctx, log_file, log_level, file, function, line, msg);
-}
+    String directory = string_create("");
+    if(slash)
+        string_append_cstr_part(&directory, watcher->fname, 0, slash == watcher->fname ? 1 : (size_t)(slash - watcher->fname));
+    else
+        string_append_cstr_part(&directory, ".", 0, 1);
 
-LOG_EXPORT LogTarget* log_target_file_create(const char* layout, enum LogLevel min_level, enum LogLevel max_level, struct LogFileTargetContext* ctx) {
-    LogTarget* target = malloc(sizeof(*target));
-    if(!target)
-        return NULL;
+    int watch = inotify_add_watch(watcher->fd, string_data(&directory), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    string_free_resources(&directory);
+    if(watch == -1)
+        goto error;
 
-    struct LogFormat* fmt = mist_log_parse_format(layout, 0, strlen(layout));
-    if(!fmt) {
-        free(target);
+    watcher->running = 1;
+    if(!log_thread_start(&watcher->thread, log_config_watcher_run, watcher))
+        goto error;
+
+    return watcher;
+
+    error:
+        if(watcher->fd != -1)
+            close(watcher->fd);
+
+        log_config_applied_free_resources(&watcher->applied);
+        free(watcher->fname);
+        free(watcher);
         return NULL;
-    }
+}
 
-    target->format = fmt;
-    target->free = log_file_target_context_free;
-    target->ctx = ctx;
-    target->log = log_file_log;
-    target->min_level = min_level;
-    target->max_level = max_level;
+LOG_EXPORT void log_config_watcher_free(struct LogConfigWatcher* watcher) {
+    if(!watcher)
+        return;
 
-    return target;
-}
\ No newline at end of file
+    log_atomic_store_size(&watcher->running, 0);
+    log_thread_join(&watcher->thread);
+
+    close(watcher->fd);
+    log_config_applied_free_resources(&watcher->applied);
+    free(watcher->fname);
+    free(watcher);
+}
+
+#else
+
+LOG_EXPORT struct LogConfigWatcher* log_logger_watch_config(Logger* logger, const char* fname) {
+    return NULL;
+}
+
+LOG_EXPORT void log_config_watcher_free(struct LogConfigWatcher* watcher) {
+}
+
+#endif
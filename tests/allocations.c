@@ -0,0 +1,116 @@
+#include "../include/mist_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Checks that logging doesn't allocate once the buffers it reuses have grown to fit the messages. Every allocation
+// made by the library is counted by wrapping malloc, calloc and realloc at link time (see meson.build), and any made
+// after a warm-up run fails the test.
+
+#define WARM_UP_MESSAGES 1000
+#define MEASURED_MESSAGES 10000
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static volatile size_t allocations = 0;
+
+void* __wrap_malloc(size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static void memory_log(enum LogLevel log_level, const char* file, const char* function, uint32_t line, String* msg, void* ctx) {
+    size_t* size = ctx;
+    *size += string_size(msg);
+}
+
+static LogTarget* memory_target_create(size_t* size) {
+    char layout[] = "${time} | ${level} | ${file}:${line} ${function} | ${message}";
+    struct LogFormat* format = mist_log_parse_format(layout, 0, strlen(layout));
+    LogTarget* target = malloc(sizeof(*target));
+    if(!format || !target) {
+        free(target);
+        return NULL;
+    }
+
+    log_target_init(target, format, LOG_TRACE, LOG_FATAL);
+    target->log = memory_log;
+    target->ctx = size;
+    return target;
+}
+
+// Both runs log from the same call sites, so that registering them is part of the warm-up.
+static void log_messages(Logger* logger, int count) {
+    for(int i = 0; i < count; i++) {
+        log_info(logger, "Message %d with an argument too long to fit in a small string: %s", i, "abcdefghijklmnopqrstuvwxyz");
+        log_warn(logger, "%.*s", 40, "A message that only uses part of its argument, which is long too");
+    }
+
+    log_logger_flush(logger);
+}
+
+static bool run(const char* name, bool async, bool deferred) {
+    static size_t written = 0;
+    bool result = false;
+
+    Logger* logger = log_logger_create();
+    if(!logger)
+        return false;
+
+    struct LogFileTargetContext* ctx = log_file_target_context_create("allocations_${level}.log");
+    LogTarget* file = ctx ? log_target_file_create("${level} | ${message}", LOG_TRACE, LOG_FATAL, ctx) : NULL;
+    LogTarget* memory = memory_target_create(&written);
+
+    if(!file || !log_add_target(logger, file)) {
+        log_target_free(file);
+        goto end;
+    }
+
+    if(!memory || !log_add_target(logger, memory)) {
+        log_target_free(memory);
+        goto end;
+    }
+
+    if(async && !log_logger_enable_async(logger, 1024, LOG_QUEUE_BLOCK, LOG_TRACE))
+        goto end;
+
+    if(deferred && !log_logger_set_deferred_formatting(logger, true))
+        goto end;
+
+    log_messages(logger, WARM_UP_MESSAGES);
+
+    size_t before = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    log_messages(logger, MEASURED_MESSAGES);
+    size_t after = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+
+    printf("%s: %zu allocations after warm-up\n", name, after - before);
+    result = after == before;
+
+    end:
+        log_logger_free(logger);
+        return result;
+}
+
+int main(void) {
+    bool passed = run("synchronous", false, false);
+    passed = run("asynchronous", true, false) && passed;
+    passed = run("deferred formatting", true, true) && passed;
+
+    log_shutdown();
+
+    remove("allocations_Info.log");
+    remove("allocations_Warn.log");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,42 @@
+#include "../include/mist_log.h"
+
+#include <stdio.h>
+
+static const char* default_layout = "${level} | ${file}:${line} | ${function} | ${message}";
+
+int main(int argc, char** argv) {
+    if(argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <binary log file> [layout]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* layout = argc == 3 ? argv[2] : default_layout;
+    Logger* logger = NULL;
+    LogTarget* console = NULL;
+
+    logger = log_logger_create();
+    if(!logger) {
+        return EXIT_FAILURE;
+    }
+
+    console = log_target_console_create(layout, LOG_TRACE, LOG_FATAL);
+    if(!console) {
+        fprintf(stderr, "Invalid layout: %s\n", layout);
+        log_logger_free(logger);
+        return EXIT_FAILURE;
+    }
+
+    if(!log_add_target(logger, console)) {
+        log_logger_free(logger);
+        log_target_free(console);
+        return EXIT_FAILURE;
+    }
+
+    bool result = mist_log_binary_replay(argv[1], logger);
+    if(!result)
+        fprintf(stderr, "Failed to decode %s\n", argv[1]);
+
+    log_logger_free(logger);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}